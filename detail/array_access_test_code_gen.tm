@@ -46,6 +46,7 @@
 * -> assign vector
 * -> Vector
 * -> Const
+ 21:    JEQ  0,21(7) 	repeat: jmp to end
  22:    LDC  0,1(0) 	load const
 * <- Const
  23:     LD  1,-13(2) 	get the address of the vector
@@ -80,7 +81,6 @@
  41:     ST  0,-35(2) 	assign: store value
 * <- assign
  42:    LDA  7,-31(7) 	jump to savedLoc1
- 21:    JEQ  0,21(7) 	repeat: jmp to end
 * <- repeat
 * -> while
 * repeat: jump after body comes back here
@@ -104,6 +104,7 @@
 * -> Op
 * -> Id
 * -> Vector
+ 52:    JEQ  0,22(7) 	repeat: jmp to end
  53:     LD  0,-13(2) 	get the address of the vector
  54:     LD  3,-35(2) 	get the value of the index
  55:    LDC  4,1(0) 	load 1
@@ -131,7 +132,6 @@
  72:    SUB  1,1,3 	get the address
  73:     ST  0,0(1) 	get the value of the vector
  74:    LDA  7,-32(7) 	jump to savedLoc1
- 52:    JEQ  0,22(7) 	repeat: jmp to end
 * <- repeat
 * <- End Function
 * End of execution.
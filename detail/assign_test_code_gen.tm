@@ -5,6 +5,7 @@
   2:     ST  0,0(0) 	clear location 0
 * End of standard prelude.
 * -> Init Function (funOne)
+  3:    LDA  7,24(7) 	jump to main
   4:     ST  0,-1(2) 	store return address from ac
 * -> declare var
 * <- declare var
@@ -59,7 +60,6 @@
  27:     LD  7,-1(1) 	return to caller
 * <- End Function
 * -> Init Function (main)
-  3:    LDA  7,24(7) 	jump to main
 * -> declare var
 * <- declare var
 * -> declare var
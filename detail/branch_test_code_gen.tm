@@ -33,19 +33,19 @@
 * if: jump to else belongs here
 * -> assign
 * -> Const
+ 13:    JEQ  0,3(7) 	if: jmp to else
  14:    LDC  0,0(0) 	load const
 * <- Const
  15:     ST  0,-2(2) 	assign: store value
 * <- assign
 * if: jump to end belongs here
- 13:    JEQ  0,3(7) 	if: jmp to else
 * -> assign
 * -> Const
+ 16:    LDA  7,2(7) 	jmp to end
  17:    LDC  0,1(0) 	load const
 * <- Const
  18:     ST  0,-2(2) 	assign: store value
 * <- assign
- 16:    LDA  7,2(7) 	jmp to end
 * <- if
 * -> if
 * -> Op
@@ -67,6 +67,7 @@
 * -> assign
 * -> Op
 * -> Id
+ 28:    JEQ  0,21(7) 	if: jmp to else
  29:     LD  0,-4(2) 	load id value
 * <- Id
  30:     ST  0,-6(2) 	op: push left
@@ -109,7 +110,6 @@
  48:     ST  0,-4(2) 	assign: store value
 * <- assign
 * if: jump to end belongs here
- 28:    JEQ  0,21(7) 	if: jmp to else
  49:    LDA  7,0(7) 	jmp to end
 * <- if
 * -> if
@@ -131,14 +131,15 @@
 * if: jump to else belongs here
 * -> assign
 * -> Const
+ 59:    JEQ  0,3(7) 	if: jmp to else
  60:    LDC  0,8(0) 	load const
 * <- Const
  61:     ST  0,-3(2) 	assign: store value
 * <- assign
 * if: jump to end belongs here
- 59:    JEQ  0,3(7) 	if: jmp to else
 * -> assign
 * -> Const
+ 62:    LDA  7,16(7) 	jmp to end
  63:    LDC  0,75(0) 	load const
 * <- Const
  64:     ST  0,-4(2) 	assign: store value
@@ -173,7 +174,6 @@
 * <- Op
  78:     ST  0,-3(2) 	assign: store value
 * <- assign
- 62:    LDA  7,16(7) 	jmp to end
 * <- if
 * -> while
 * repeat: jump after body comes back here
@@ -195,6 +195,7 @@
 * -> assign
 * -> Op
 * -> Id
+ 88:    JEQ  0,19(7) 	repeat: jmp to end
  89:     LD  0,-5(2) 	load id value
 * <- Id
  90:     ST  0,-6(2) 	op: push left
@@ -235,7 +236,6 @@
 106:     ST  0,-5(2) 	assign: store value
 * <- assign
 107:    LDA  7,-29(7) 	jump to savedLoc1
- 88:    JEQ  0,19(7) 	repeat: jmp to end
 * <- repeat
 * <- End Function
 * End of execution.
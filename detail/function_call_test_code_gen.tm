@@ -5,6 +5,7 @@
   2:     ST  0,0(0) 	clear location 0
 * End of standard prelude.
 * -> Init Function (f)
+  3:    LDA  7,18(7) 	jump to main
   4:     ST  0,-1(2) 	store return address from ac
 * -> Param
 * <- Param
@@ -49,7 +50,6 @@
 * <- return
 * <- End Function
 * -> Init Function (main)
-  3:    LDA  7,18(7) 	jump to main
 * -> declare var
 * <- declare var
 * -> declare var
@@ -0,0 +1,38 @@
+* TINY Compilation to TM Code
+* Standard prelude:
+  0:     LD  6,0(0) 	load maxaddress from location 0
+  1:     LD  2,0(0) 	load maxaddress from location 0
+  2:     ST  0,0(0) 	clear location 0
+* End of standard prelude.
+* -> Init Function (f)
+  3:    LDA  7,7(7) 	jump to main
+  4:     ST  0,-1(2) 	store return address
+* -> Declare Vector
+  5:    LDA  0,-2(2) 	load local vector
+  6:     ST  0,-2(2) 	store local vector
+* <- Declare Vector
+* -> Declare Var
+* <- Declare Var
+* -> assign
+* -> Const
+  7:    LDC  0,1(0) 	load const
+* <- Const
+  8:     ST  0,-8(2) 	assign: store value
+* <- assign
+* <- Function
+* -> Declare Vector
+  9:    LDA  0,-9(2) 	load local vector
+ 10:     ST  0,-9(2) 	store local vector
+* <- Declare Vector
+* -> Init Function (main)
+* -> Declare Var
+* <- Declare Var
+* -> assign
+* -> Const
+ 11:    LDC  0,2(0) 	load const
+* <- Const
+ 12:     ST  0,-2(2) 	assign: store value
+* <- assign
+* <- Function
+* End of execution.
+ 13:   HALT  0,0,0 	
@@ -5,6 +5,7 @@
   2:     ST  0,0(0) 	clear location 0
 * End of standard prelude.
 * -> Init Function (gdc)
+  3:    LDA  7,39(7) 	jump to main
   4:     ST  0,-1(2) 	store return address from ac
 * -> Param
 * <- Param
@@ -29,6 +30,7 @@
 * if: jump to else belongs here
 * -> return
 * -> Id
+ 14:    JEQ  0,5(7) 	if: jmp to else
  15:     LD  0,-2(2) 	load id value
 * <- Id
  16:    LDA  1,0(2) 	save current fp into ac1
@@ -36,9 +38,9 @@
  18:     LD  7,-1(1) 	return to caller
 * <- return
 * if: jump to end belongs here
- 14:    JEQ  0,5(7) 	if: jmp to else
 * -> return
 * -> Function Call (gdc)
+ 19:    LDA  7,23(7) 	jmp to end
  20:     ST  2,-4(2) 	Guard fp
 * -> Id
  21:     LD  0,-3(2) 	load id value
@@ -80,11 +82,9 @@
  41:     LD  2,0(2) 	make fp = ofp
  42:     LD  7,-1(1) 	return to caller
 * <- return
- 19:    LDA  7,23(7) 	jmp to end
 * <- if
 * <- End Function
 * -> Init Function (main)
-  3:    LDA  7,39(7) 	jump to main
 * -> declare var
 * <- declare var
 * -> declare var
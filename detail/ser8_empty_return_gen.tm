@@ -5,6 +5,7 @@
   2:     ST  0,0(0) 	clear location 0
 * End of standard prelude.
 * -> Init Function (gdc)
+  3:    LDA  7,46(7) 	jump to main
   4:     ST  0,-1(2) 	store return address from ac
 * -> Param
 * <- Param
@@ -47,14 +48,15 @@
 * if: jump to else belongs here
 * -> assign
 * -> Id
+ 18:    JEQ  0,3(7) 	if: jmp to else
  19:     LD  0,-2(2) 	load id value
 * <- Id
  20:     ST  0,-5(2) 	assign: store value
 * <- assign
 * if: jump to end belongs here
- 18:    JEQ  0,3(7) 	if: jmp to else
 * -> assign
 * -> Function Call (gdc)
+ 21:    LDA  7,21(7) 	jmp to end
  22:     ST  2,-7(2) 	Guard fp
 * -> Id
  23:     LD  0,-3(2) 	load id value
@@ -94,7 +96,6 @@
 * <- Function Call
  42:     ST  0,-5(2) 	assign: store value
 * <- assign
- 21:    LDA  7,21(7) 	jmp to end
 * <- if
 * -> assign
 * -> Const
@@ -115,7 +116,6 @@
 * <- return
 * <- End Function
 * -> Init Function (main)
-  3:    LDA  7,46(7) 	jump to main
 * -> declare var
 * <- declare var
 * -> declare var
@@ -10,6 +10,7 @@
   5:     ST  0,10(5) 	store ac in global_position_aux
 * <- declare vector
 * -> Init Function (minloc)
+  6:    LDA  7,126(7) 	jump to main
   7:     ST  0,-1(2) 	store return address from ac
 * -> Param vet
 * <- Param vet
@@ -76,6 +77,7 @@
 * -> Op
 * -> Id
 * -> Vector
+ 32:    JEQ  0,32(7) 	repeat: jmp to end
  33:     LD  0,-2(2) 	get the address of the vector
  34:     LD  3,-5(2) 	get the value of the index
  35:    LDC  4,1(0) 	load 1
@@ -98,6 +100,7 @@
 * -> assign
 * -> Id
 * -> Vector
+ 47:    JEQ  0,10(7) 	if: jmp to else
  48:     LD  0,-2(2) 	get the address of the vector
  49:     LD  3,-5(2) 	get the value of the index
  50:    LDC  4,1(0) 	load 1
@@ -114,7 +117,6 @@
  56:     ST  0,-7(2) 	assign: store value
 * <- assign
 * if: jump to end belongs here
- 47:    JEQ  0,10(7) 	if: jmp to else
  57:    LDA  7,0(7) 	jmp to end
 * <- if
 * -> assign
@@ -132,7 +134,6 @@
  63:     ST  0,-5(2) 	assign: store value
 * <- assign
  64:    LDA  7,-42(7) 	jump to savedLoc1
- 32:    JEQ  0,32(7) 	repeat: jmp to end
 * <- repeat
 * -> return
 * -> Id
@@ -190,6 +191,7 @@
 * <- declare var
 * -> assign
 * -> Function Call (minloc)
+ 85:    JEQ  0,44(7) 	repeat: jmp to end
  86:     ST  2,-8(2) 	Guard fp
 * -> Id
 * -> Vector
@@ -265,14 +267,12 @@
 128:     ST  0,-5(2) 	assign: store value
 * <- assign
 129:    LDA  7,-58(7) 	jump to savedLoc1
- 85:    JEQ  0,44(7) 	repeat: jmp to end
 * <- repeat
 130:    LDA  1,0(2) 	save current fp into ac1
 131:     LD  2,0(2) 	make fp = ofp
 132:     LD  7,-1(1) 	return to caller
 * <- End Function
 * -> Init Function (main)
-  6:    LDA  7,126(7) 	jump to main
 * -> declare var
 * <- declare var
 * -> assign
@@ -301,6 +301,7 @@
 * -> assign vector
 * -> Vector
 * -> Function Call (input)
+144:    JEQ  0,15(7) 	repeat: jmp to end
 145:     IN  0,0,0 	read input
 146:    LDC  5,0(0) 	load 0
 147:     LD  1,10(5) 	get the address of the vector
@@ -324,7 +325,6 @@
 158:     ST  0,-2(2) 	assign: store value
 * <- assign
 159:    LDA  7,-25(7) 	jump to savedLoc1
-144:    JEQ  0,15(7) 	repeat: jmp to end
 * <- repeat
 * -> Function Call (sort)
 160:     ST  2,-3(2) 	Guard fp
@@ -372,6 +372,7 @@
 * -> Function Call (output)
 * -> Id
 * -> Vector
+182:    JEQ  0,15(7) 	repeat: jmp to end
 183:    LDC  5,0(0) 	load 0
 184:     LD  0,10(5) 	get the address of the vector
 185:     LD  3,-2(2) 	get the value of the index
@@ -396,7 +397,6 @@
 196:     ST  0,-2(2) 	assign: store value
 * <- assign
 197:    LDA  7,-25(7) 	jump to savedLoc1
-182:    JEQ  0,15(7) 	repeat: jmp to end
 * <- repeat
 * <- End Function
 * End of execution.
@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 
 /// error output 
 FILE* fileER_;
@@ -21,6 +22,26 @@ FileDestination currentState;
 
 void splitFileName(const char *fullFileName, char *path, char *fileName, char *extension);
 
+/**
+ * \brief aux func: formats a message into buffer, or into a malloc'd string when it does not fit
+ * \return the message; free it when it is not buffer
+ */
+static char* formatMessage(char* buffer, size_t size, const char* format, va_list args) {
+    va_list retry;
+    va_copy(retry, args);
+    int length = vsnprintf(buffer, size, format, args);
+    if (length >= 0 && (size_t) length >= size) {
+        char* message = malloc(length + 1);
+        if (message) {
+            vsnprintf(message, length + 1, format, retry);
+            va_end(retry);
+            return message;
+        }
+    }
+    va_end(retry);
+    return buffer;
+}
+
 /**
  * \brief open the files specified by files2open in the directory specified by path, with the basename specified
  * 
@@ -37,10 +58,6 @@ void splitFileName(const char *fullFileName, char *path, char *fileName, char *e
  * 
  */
 void initializePrinter(const char *path, const char* baseName, FileDestination files2open) {
-    char basepath[512];
-    char basefileName[256];
-    char baseextension[256];
-    splitFileName(baseName, basepath, basefileName, baseextension);
     currentState = LEX;
     
     if (!path) { fprintf(stderr, "called initializePrinter with path == NULL"); abort(); }
@@ -49,33 +66,54 @@ void initializePrinter(const char *path, const char* baseName, FileDestination f
     char filename[512];
 
     if (files2open & ER_) { 
-        int ret = snprintf(filename, sizeof(filename), "%s/%s_err.txt",path, basefileName);
-        if (ret < 0) { fprintf(stderr,"FAILED WRITING FILENAME _err FOR %s",baseName); abort(); }
+        if (detailFileName(filename, sizeof(filename), path, baseName, ER_) < 0) { fprintf(stderr,"FAILED WRITING FILENAME _err FOR %s",baseName); abort(); }
         fileER_ = fopen(filename, "w");
     }
 
     if (files2open & LEX) { 
-        snprintf(filename, sizeof(filename), "%s/%s_lex.txt",path, basefileName);
+        detailFileName(filename, sizeof(filename), path, baseName, LEX);
         fileLEX = fopen(filename, "w");
     }
 
     if (files2open & SYN) { 
-        snprintf(filename, sizeof(filename), "%s/%s_syn.txt",path, basefileName);
+        detailFileName(filename, sizeof(filename), path, baseName, SYN);
         fileSYN = fopen(filename, "w");
     }
 
     if (files2open & TAB) { 
-        snprintf(filename, sizeof(filename), "%s/%s_tab.txt",path, basefileName);
+        detailFileName(filename, sizeof(filename), path, baseName, TAB);
         fileTAB = fopen(filename, "w");
     }
     
     if (files2open & GEN) { 
-        snprintf(filename, sizeof(filename), "%s/%s_gen.tm",path, basefileName);
+        detailFileName(filename, sizeof(filename), path, baseName, GEN);
         fileGEN = fopen(filename, "w");
     }
     filesOpened = files2open;
 }//initializePrinter
 
+/**
+ * \brief writes into filename the name of the output file of one destination (ER_, LEX, SYN, TAB or GEN)
+ * \return the result of snprintf
+ */
+int detailFileName(char* filename, size_t size, const char* path, const char* baseName, FileDestination destination) {
+    char basepath[512];
+    char basefileName[256];
+    char baseextension[256];
+    splitFileName(baseName, basepath, basefileName, baseextension);
+
+    const char* suffix = "";
+    switch (destination) {
+        case ER_: suffix = "_err.txt"; break;
+        case LEX: suffix = "_lex.txt"; break;
+        case SYN: suffix = "_syn.txt"; break;
+        case TAB: suffix = "_tab.txt"; break;
+        case GEN: suffix = "_gen.tm"; break;
+        default: break;
+    }
+    return snprintf(filename, size, "%s/%s%s", path, basefileName, suffix);
+}//detailFileName
+
 /// closes all opened files
 void closePrinter() {
     if (fileER_ != NULL) fclose(fileER_);
@@ -98,6 +136,10 @@ void doneSYNstartTAB() {
 void doneTABstartGEN() {
     currentState = GEN;
 }
+/// sets the curent compilation stage back to LEX, when declarations go through every stage one at a time
+void resumeLEX() {
+    currentState = LEX;
+}
 
 /// flushes all opened files.
 void fflushc() {
@@ -129,19 +171,64 @@ void pc(const char* format, ...) {
      char buffer[1000];
      va_list args;
      va_start(args, format);
-     vsprintf(buffer, format, args);
+     char* message = formatMessage(buffer, sizeof(buffer), format, args);
      
-     if (currentState & ER_ & filesOpened) fprintf(fileER_, "%s", buffer);
-     if (currentState & LEX & filesOpened) fprintf(fileLEX, "%s", buffer);
-     if (currentState & SYN & filesOpened) fprintf(fileSYN, "%s", buffer);
-     if (currentState & TAB & filesOpened) fprintf(fileTAB, "%s", buffer);
-     if (currentState & GEN & filesOpened) fprintf(fileGEN, "%s", buffer);
+     if (currentState & ER_ & filesOpened) fprintf(fileER_, "%s", message);
+     if (currentState & LEX & filesOpened) fprintf(fileLEX, "%s", message);
+     if (currentState & SYN & filesOpened) fprintf(fileSYN, "%s", message);
+     if (currentState & TAB & filesOpened) fprintf(fileTAB, "%s", message);
+     if (currentState & GEN & filesOpened) fprintf(fileGEN, "%s", message);
      
-     fprintf(stdout,"%s", buffer);
+     fprintf(stdout,"%s", message);
      va_end(args);
+     if (message != buffer) free(message);
     
 }//pc
 
+/// aux func: the output file of the current compilation stage, NULL when it is not open
+static FILE* stageFile() {
+    if (currentState & ER_ & filesOpened) return fileER_;
+    if (currentState & LEX & filesOpened) return fileLEX;
+    if (currentState & SYN & filesOpened) return fileSYN;
+    if (currentState & TAB & filesOpened) return fileTAB;
+    if (currentState & GEN & filesOpened) return fileGEN;
+    return NULL;
+}
+
+/// aux func: the offset of the next write to file, -1 when the file cannot be rewritten
+static long rewritableOffset(FILE* file) {
+    const long offset = ftell(file);
+    const int  flags  = fcntl(fileno(file), F_GETFL);
+    return offset < 0 || flags < 0 || (flags & O_APPEND) ? -1 : offset;
+}
+
+/**
+ * \brief marks where the next pc output goes, so that pcPatch can rewrite it later
+ * \return 0 when the output cannot be rewritten: stdout is a pipe, a terminal or opened for append
+ */
+int pcMark(PrintMark* mark) {
+    mark->file       = stageFile();
+    mark->fileOffset = mark->file ? rewritableOffset(mark->file) : 0;
+    mark->outOffset  = rewritableOffset(stdout);
+    return mark->fileOffset >= 0 && mark->outOffset >= 0;
+}
+
+/// aux func: writes text at offset in file and goes back to the end of what was written
+static void rewrite(FILE* file, long offset, const char* text) {
+    const long end = ftell(file);
+    fseek(file, offset, SEEK_SET);
+    fputs(text, file);
+    fseek(file, end, SEEK_SET);
+}
+
+/**
+ * \brief overwrites what pc printed at mark with text, which must be exactly as long
+ */
+void pcPatch(const PrintMark* mark, const char* text) {
+    if (mark->file) rewrite(mark->file, mark->fileOffset, text);
+    rewrite(stdout, mark->outOffset, text);
+}
+
 /**
  * \brief prints in CURRENT output file AND stdout AND error file (3-way)
  * 
@@ -162,18 +249,19 @@ void pc(const char* format, ...) {
      char buffer[1000];
      va_list args;
      va_start(args, format);
-     vsprintf(buffer, format, args);
+     char* message = formatMessage(buffer, sizeof(buffer), format, args);
      
      
-     if (currentState & LEX & filesOpened) fprintf(fileLEX, "%s", buffer);
-     if (currentState & SYN & filesOpened) fprintf(fileSYN, "%s", buffer);
-     if (currentState & TAB & filesOpened) fprintf(fileTAB, "%s", buffer);
-     if (currentState & GEN & filesOpened) fprintf(fileGEN, "%s", buffer);
+     if (currentState & LEX & filesOpened) fprintf(fileLEX, "%s", message);
+     if (currentState & SYN & filesOpened) fprintf(fileSYN, "%s", message);
+     if (currentState & TAB & filesOpened) fprintf(fileTAB, "%s", message);
+     if (currentState & GEN & filesOpened) fprintf(fileGEN, "%s", message);
      
-     if (ER_ & filesOpened) fprintf(fileER_, "%s", buffer);
+     if (ER_ & filesOpened) fprintf(fileER_, "%s", message);
      
-     fprintf(stdout,"%s", buffer);
+     fprintf(stdout,"%s", message);
      va_end(args);
+     if (message != buffer) free(message);
     
 }//pce
 
@@ -204,16 +292,17 @@ void pp(FileDestination destination, const char* format, ...) {
      char buffer[1000];
      va_list args;
      va_start(args, format);
-     vsprintf(buffer, format, args);
+     char* message = formatMessage(buffer, sizeof(buffer), format, args);
      
-     if (destination & ER_ & filesOpened) fprintf(fileER_, "%s", buffer);
-     if (destination & LEX & filesOpened) fprintf(fileLEX, "%s", buffer);
-     if (destination & SYN & filesOpened) fprintf(fileSYN, "%s", buffer);
-     if (destination & TAB & filesOpened) fprintf(fileTAB, "%s", buffer);
-     if (destination & GEN & filesOpened) fprintf(fileGEN, "%s", buffer);
+     if (destination & ER_ & filesOpened) fprintf(fileER_, "%s", message);
+     if (destination & LEX & filesOpened) fprintf(fileLEX, "%s", message);
+     if (destination & SYN & filesOpened) fprintf(fileSYN, "%s", message);
+     if (destination & TAB & filesOpened) fprintf(fileTAB, "%s", message);
+     if (destination & GEN & filesOpened) fprintf(fileGEN, "%s", message);
      
-     fprintf(stdout,"%s", buffer);
+     fprintf(stdout,"%s", message);
      va_end(args);
+     if (message != buffer) free(message);
     
 }//pp
 
@@ -1,6 +1,9 @@
 #ifndef VARIABLEPRINTER_H
 #define VARIABLEPRINTER_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 
 /// bitmask to select output files
 typedef enum fileDestination {
@@ -30,13 +33,26 @@ typedef enum fileDestination {
     LOGALL = 0x1F, 
 } FileDestination; 
 
+/// where pc output went, so that it can be rewritten: see pcMark
+typedef struct PrintMark {
+    /// the file of the compilation stage, NULL when it is not open
+    FILE* file;
+    long  fileOffset;
+    /// the offset in stdout
+    long  outOffset;
+} PrintMark;
+
 void initializePrinter(const char *path, const char* baseName, FileDestination files2open) ;
+int detailFileName(char* filename, size_t size, const char* path, const char* baseName, FileDestination destination);
 void pp(FileDestination destination, const char* format, ...);
 void doneLEXstartSYN() ;
 void doneSYNstartTAB() ;
 void doneTABstartGEN() ;
+void resumeLEX() ;
 void pc(const char* format, ...) ;
 void pce(const char* format, ...) ;
+int pcMark(PrintMark* mark);
+void pcPatch(const PrintMark* mark, const char* text);
 void fflushc();
 
 void closePrinter();
@@ -1,24 +1,79 @@
 #include "analyze.h"
+#include "arena.h"
 #include "globals.h"
+#include "intern.h"
+#include "util.h"
+#include "visit.h"
 
 #include <log.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
-static TypeInfo* currentFunctionType = NULL;
-static bool      declaredMain        = FALSE;
-static bool      functionDeclared    = FALSE;
-
-Scope* globalScope  = NULL;
-Scope* currentScope = NULL;
-
-static int tmpOffset    = MAX_MEMORY - 2;
-static int globalOffset = 0;
+static _Thread_local TypeInfo* currentFunctionType = NULL;
+static bool                    declaredMain        = FALSE;
+static _Thread_local bool      functionDeclared    = FALSE;
+
+Scope*               globalScope  = NULL;
+_Thread_local Scope* currentScope = NULL;
+
+static _Thread_local int tmpOffset    = MAX_MEMORY - 2;
+static int               globalOffset = 0;
+
+/* type errors are found during the one traversal but
+ * reported after the symbol table, as the separate
+ * type checking pass used to report them */
+static _Thread_local bool deferErrors        = FALSE;
+static const char**       deferredErrors     = NULL;
+static int                deferredErrorCount = 0;
+
+/* Parallel analysis (AnalyzeThreads > 1). Each top-level
+ * declaration is a Unit. The global scope is filled in
+ * first, in order, and every function enters its own
+ * scope; then the bodies of the functions are analyzed
+ * on worker threads, against the global scope, which
+ * they only read (see shareScope), and in scopes of their
+ * own. Until all are done a unit keeps its diagnostics
+ * and the references it makes to global symbols, which
+ * are then applied in source order
+ */
+typedef struct Reference {
+	Symbol* symbol;
+	int     lineNo;
+} Reference;
+
+typedef struct Unit {
+	ASTNode*     declaration;
+	Scope*       within;       /* the current scope when the unit starts */
+	Scope*       body;         /* the scope a worker analyzes the body in */
+	TypeInfo*    functionType; /* and currentFunctionType there */
+	int          tmpOffset;    /* after the unit */
+	bool         merged;       /* analyzed when merged */
+	const char** errors;       /* reported as they are found */
+	int          errorCount;
+	const char** typeErrors;   /* reported after the symbol table */
+	int          typeErrorCount;
+	Reference*   references;
+	int          referenceCount;
+} Unit;
+
+typedef struct Worker {
+	pthread_t thread;
+	Arena     arena;
+} Worker;
+
+/* the unit this thread analyzes, NULL when reporting directly */
+static _Thread_local Unit* unit = NULL;
+
+static Unit*      units;
+static int        unitCount;
+static atomic_int nextUnit;
 
 void enterScope(const char* name) {
 	if (currentScope) {
 		for (int i = 0; i < currentScope->childCount; i++) {
-			if (strcmp(currentScope->children[i]->name, name) == 0) {
+			if (currentScope->children[i]->name == name) {
 				currentScope = currentScope->children[i];
 				return;
 			}
@@ -28,13 +83,9 @@ void enterScope(const char* name) {
 	Scope* newScope = createScope(name, currentScope);
 
 	if (currentScope) {
-		if (!currentScope->children) {
-			currentScope->children   = (Scope**) malloc(sizeof(Scope*));
-			currentScope->childCount = 0;
-		} else {
-			currentScope->children = (Scope**) realloc(
-			    currentScope->children, sizeof(Scope*) * (currentScope->childCount + 1));
-		}
+		currentScope->children =
+		    ARENA_GROW_ARRAY(threadArena, Scope*, currentScope->children,
+		                     currentScope->childCount, currentScope->childCount + 1);
 		currentScope->children[currentScope->childCount++] = newScope;
 	}
 
@@ -50,15 +101,52 @@ void leaveScope(ASTNode* t) {
     }
 }
 
+/* resolve records on t the symbol that t declares or
+ * uses, and how code generation is to address it */
+static void resolve(ASTNode* t, Symbol* symbol) {
+	t->symbol  = symbol;
+	t->offset  = symbol->offset;
+	t->storage = currentScope == globalScope ? STORAGE_GLOBAL : STORAGE_FRAME;
+}
+
+static void deferError(const char* error) {
+	deferredErrors = ARENA_GROW_ARRAY(&compileArena, const char*, deferredErrors, deferredErrorCount,
+	                                  deferredErrorCount + 1);
+	deferredErrors[deferredErrorCount++] = error;
+}
+
+/* keep appends item to the array of count items at
+ * list, which doubles whenever count reaches a power
+ * of two */
+#define keep(list, count, item)                                                                    \
+	do {                                                                                           \
+		if (((count) & ((count) - 1)) == 0)                                                        \
+			(list) = arenaGrow(threadArena, (list), sizeof(*(list)) * (count),                     \
+			                   sizeof(*(list)) * ((count) ? 2 * (count) : 1));                     \
+		(list)[(count)++] = (item);                                                                \
+	} while (0)
+
 static void typeError(const ASTNode* t, const char* message) {
-	pce("Semantic error at line %d: %s\n", t->lineNo, message);
+	if (unit) {
+		const char* error = formatString("Semantic error at line %d: %s\n", t->lineNo, message);
+		if (deferErrors)
+			keep(unit->typeErrors, unit->typeErrorCount, error);
+		else
+			keep(unit->errors, unit->errorCount, error);
+		return;
+	}
+	if (deferErrors) {
+		deferError(formatString("Semantic error at line %d: %s\n", t->lineNo, message));
+	} else {
+		pce("Semantic error at line %d: %s\n", t->lineNo, message);
+	}
 	Error = TRUE;
 }
 
 static bool checkBinaryOperands(const ASTNode* t, const TypeInfo* expectedType) {
 	if (!t || !expectedType) return false;
 
-	const ASTNode* leftNode = t->children[0];
+	const ASTNode* leftNode = astChild(t, 0);
 	if (!leftNode) {
 		typeError(t, "Missing left operand");
 		return false;
@@ -91,7 +179,7 @@ static bool checkBinaryOperands(const ASTNode* t, const TypeInfo* expectedType)
 		return false;
 	}
 
-	const ASTNode* rightNode = t->children[1];
+	const ASTNode* rightNode = astChild(t, 1);
 	if (!rightNode) {
 		typeError(t, "Missing right operand");
 		return false;
@@ -127,15 +215,20 @@ static bool checkBinaryOperands(const ASTNode* t, const TypeInfo* expectedType)
 	return true;
 }
 
-static void traverse(ASTNode* t, void (*preProc)(ASTNode*), void (*postProc)(ASTNode*)) {
-	if (t) {
-		preProc(t);
-		for (int i = 0; i < MAXCHILDREN; i++) traverse(t->children[i], preProc, postProc);
-		postProc(t);
-		traverse(t->next, preProc, postProc);
-	}
+/* reference adds a reference to symbol. While units
+ * are analyzed those to global symbols wait for the
+ * merge, so that workers leave the global scope alone
+ */
+static void reference(Symbol* symbol, const int lineNo) {
+	if (unit && symbol && findSymbolInScope(globalScope, symbol->name) == symbol)
+		keep(unit->references, unit->referenceCount, ((Reference) {symbol, lineNo}));
+	else
+		addReference(symbol, lineNo);
 }
 
+/* the stack of the traversal, kept for the next program */
+static VisitStack analyzeStack;
+
 static void nullProc(ASTNode* t) {
 	if (t->kind == NODE_FUNCTION) {
 		currentFunctionType = t->data.symbol.type->returnType;
@@ -161,7 +254,7 @@ static void insertNode(ASTNode* t) {
 				typeError(t, "Function already declared in this scope");
 				return;
 			}
-			if (strcmp(t->data.symbol.name, "main") == 0) {
+			if (t->data.symbol.name == nameMain) {
 				declaredMain = TRUE;
 			}
 			tmpOffset                    = MAX_MEMORY - 2;
@@ -169,7 +262,8 @@ static void insertNode(ASTNode* t) {
 			                                            t->data.symbol.type->returnType, MAX_MEMORY - 1);
 			symbol->sourceInfo.definedAt = t->lineNo;
 			addSymbol(currentScope, symbol);
-			addReference(symbol, t->lineNo);
+			reference(symbol, t->lineNo);
+			resolve(t, symbol);
 			currentFunctionType = t->data.symbol.type;
 			enterScope(t->data.symbol.name);
 			functionDeclared = TRUE;
@@ -179,17 +273,15 @@ static void insertNode(ASTNode* t) {
 		case NODE_VARIABLE:
 			if ((symbol = findSymbolInScope(currentScope, t->data.symbol.name))) {
 				if (symbol->kind == SYMBOL_VARIABLE) {
-					char err[100];
-					sprintf(err, "'%s' was already declared as a variable", t->data.symbol.name);
-					typeError(t, err);
+					typeError(t, formatString("'%s' was already declared as a variable",
+					                          t->data.symbol.name));
 					return;
 				}
 			}
 			if ((symbol = findSymbolInScope(globalScope, t->data.symbol.name))) {
 				if (symbol->kind == SYMBOL_FUNCTION) {
-					char err[100];
-					sprintf(err, "'%s' was already declared as a function", t->data.symbol.name);
-					typeError(t, err);
+					typeError(t, formatString("'%s' was already declared as a function",
+					                          t->data.symbol.name));
 					return;
 				}
 			}
@@ -218,7 +310,8 @@ static void insertNode(ASTNode* t) {
 			}
 			symbol->sourceInfo.definedAt = t->lineNo;
 			addSymbol(currentScope, symbol);
-			addReference(symbol, t->lineNo);
+			reference(symbol, t->lineNo);
+			resolve(t, symbol);
 			break;
 
 		// Offsets updated
@@ -236,20 +329,21 @@ static void insertNode(ASTNode* t) {
 			}
 			symbol->sourceInfo.definedAt = t->lineNo;
 			addSymbol(currentScope, symbol);
-			addReference(symbol, t->lineNo);
+			reference(symbol, t->lineNo);
+			resolve(t, symbol);
 			break;
 
 		case NODE_IDENTIFIER:
 		case NODE_CALL:
 			symbol = findSymbol(currentScope, t->data.symbol.name);
 			if (!symbol) {
-				const char err[100];
-				sprintf(err, "'%s' was not declared in this scope", t->data.symbol.name);
-				typeError(t, err);
+				typeError(t, formatString("'%s' was not declared in this scope",
+				                          t->data.symbol.name));
 				return;
 			}
-			addReference(symbol, t->lineNo);
+			reference(symbol, t->lineNo);
 			t->data.symbol.type = symbol->type;
+			resolve(t, symbol);
 			break;
 
 		default:
@@ -257,16 +351,22 @@ static void insertNode(ASTNode* t) {
 	}
 }
 
-void buildSymTab(ASTNode* syntaxTree) {
-	globalScope  = createScope("global", NULL);
-	currentScope = globalScope;
-	addSymbol(globalScope, createSymbol("input", SYMBOL_FUNCTION, createType(TYPE_INT), 0));
-	addSymbol(globalScope, createSymbol("output", SYMBOL_FUNCTION, createType(TYPE_VOID), 0));
-
-	traverse(syntaxTree, insertNode, leaveScope);
+static int operandRegisters(const ASTNode* t) {
+	return t && t->kind == NODE_OPERATOR ? t->registers : 0;
+}
 
-	currentScope = globalScope;
-	if (TraceAnalyze) printSymbolTable(globalScope, declaredMain);
+/* Function operatorRegisters counts the registers,
+ * besides AC, that the code of operator t needs when
+ * the operand needing more is generated first and a
+ * simple right operand is loaded last (Sethi-Ullman)
+ */
+static int operatorRegisters(const ASTNode* t) {
+	const ASTNode* rightNode = astChild(t, 1);
+	const int      left      = operandRegisters(astChild(t, 0));
+	if (!rightNode || astSimpleOperand(rightNode)) return left;
+	const int right = operandRegisters(rightNode);
+	if (left != right) return left > right ? left : right;
+	return left < UINT8_MAX ? left + 1 : left;
 }
 
 static void checkNode(ASTNode* t) {
@@ -299,20 +399,21 @@ static void checkNode(ASTNode* t) {
 				default:
 					break;
 			}
+			t->registers = operatorRegisters(t);
 			break;
 
 		case NODE_IF:
 		case NODE_WHILE:
-			if (t->children[0]) {
-				if (t->children[0]->resultType->baseType != TYPE_BOOLEAN)
+			if (astChild(t, 0)) {
+				if (astChild(t, 0)->resultType->baseType != TYPE_BOOLEAN)
 					typeError(t, "Condition must be a boolean expression");
 			}
 			break;
 
 		case NODE_ASSIGN:
-			if (t->children[0] && t->children[1]) {
-				const ASTNode* leftNode  = t->children[0];
-				const ASTNode* rightNode = t->children[1];
+			if (astChild(t, 0) && astChild(t, 1)) {
+				const ASTNode* leftNode  = astChild(t, 0);
+				const ASTNode* rightNode = astChild(t, 1);
 
 				const TypeInfo* leftType  = NULL;
 				const TypeInfo* rightType = NULL;
@@ -374,14 +475,13 @@ static void checkNode(ASTNode* t) {
 
 		case NODE_RETURN:
 			if (currentFunctionType) {
-				if (!t->children[0] && currentFunctionType->baseType != TYPE_VOID) {
-					char err[100];
-					sprintf(err, "Function of type %s missing return value",
-					        currentFunctionType->baseType == TYPE_INT ? "int" : "void");
-					typeError(t, err);
+				if (!astChild(t, 0) && currentFunctionType->baseType != TYPE_VOID) {
+					typeError(t, formatString("Function of type %s missing return value",
+					                          currentFunctionType->baseType == TYPE_INT ? "int"
+					                                                                    : "void"));
 					break;
 				}
-				if (t->children[0] && currentFunctionType->baseType != TYPE_INT) {
+				if (astChild(t, 0) && currentFunctionType->baseType != TYPE_INT) {
 					typeError(t, "Return statement with return value in void function");
 				}
 			}
@@ -392,9 +492,211 @@ static void checkNode(ASTNode* t) {
 	}
 }
 
-void typeCheck(ASTNode* syntaxTree) {
+/* declareNode and checkAndLeave are the preorder and
+ * postorder visits of the one analysis traversal: the
+ * symbol table is built on the way down, and the types
+ * of a node are checked once its children are done
+ */
+static void declareNode(ASTNode* t) {
+	insertNode(t);
+	nullProc(t);
+}
+
+static void checkAndLeave(ASTNode* t) {
+	deferErrors = TRUE;
+	checkNode(t);
+	deferErrors = FALSE;
+	leaveScope(t);
+}
+
+void startAnalysis(void) {
+	if (TraceAnalyze) fprintf(listing, "\nBuilding Symbol Table...\n");
+	globalScope         = createScope(nameGlobal, NULL);
 	currentScope        = globalScope;
 	currentFunctionType = NULL;
-	traverse(syntaxTree, nullProc, checkNode);
+	deferredErrors      = NULL;
+	deferredErrorCount  = 0;
+	addSymbol(globalScope, createSymbol(nameInput, SYMBOL_FUNCTION, createType(TYPE_INT), 0));
+	addSymbol(globalScope, createSymbol(nameOutput, SYMBOL_FUNCTION, createType(TYPE_VOID), 0));
+}
+
+/* analyzeChildren visits the children of t as the
+ * traversal does, after declareNode(t) and before
+ * checkAndLeave(t) */
+static void analyzeChildren(VisitStack* stack, ASTNode* t) {
+	for (int i = 0; i < MAXCHILDREN; i++)
+		visitTree(stack, astChild(t, i), declareNode, checkAndLeave);
+}
+
+/* analyzeBodies is a worker: it takes the next unit
+ * until there are none left, and analyzes the body of
+ * the unit's function, if it has one to analyze
+ */
+static void* analyzeBodies(void* argument) {
+	Worker*    worker = argument;
+	VisitStack stack  = {0};
+	threadArena       = &worker->arena;
+	shareScope(globalScope);
+
+	for (int i; (i = atomic_fetch_add(&nextUnit, 1)) < unitCount;) {
+		if (!units[i].body) continue;
+		unit                = &units[i];
+		currentScope        = unit->body;
+		currentFunctionType = unit->functionType;
+		functionDeclared    = TRUE;
+		tmpOffset           = MAX_MEMORY - 2;
+		analyzeChildren(&stack, unit->declaration);
+		unit->tmpOffset = tmpOffset;
+	}
+	free(stack.frames);
+	unit = NULL;
+	closeScopes();
+	shareScope(NULL);
+	threadArena = &compileArena;
+	return NULL;
+}
+
+/* analyzeOnThread runs analyzeBodies on a thread of its
+ * own, and drops the thread's binding stacks after it
+ */
+static void* analyzeOnThread(void* argument) {
+	analyzeBodies(argument);
+	releaseScopes();
+	return NULL;
+}
+
+/* startUnits does what the traversal does before the
+ * bodies: it fills in the global scope and enters the
+ * scope of each function. The body of a function that
+ * did not get a scope of its own, say for a name
+ * declared twice, is analyzed here, in the traversal's
+ * way. A variable after a body is left to the merge:
+ * it is offset below the locals of the body, as the
+ * traversal leaves them in the current scope, which by
+ * then is no longer the global one (see leaveScope)
+ */
+static void startUnits(void) {
+	bool bodies = FALSE;
+	for (int i = 0; i < unitCount; i++) {
+		Unit*    u = &units[i];
+		ASTNode* t = u->declaration;
+		u->within  = currentScope;
+		if (bodies && t->kind != NODE_FUNCTION) {
+			u->merged = TRUE;
+			continue;
+		}
+
+		unit = u;
+		declareNode(t);
+		if (t->kind == NODE_FUNCTION && functionDeclared && !currentScope->open) {
+			u->body         = currentScope;
+			u->functionType = currentFunctionType;
+			bodies          = TRUE;
+
+			/* where the body leaves the current scope */
+			if (astChild(t, 1)) leaveScope(astChild(t, 1));
+			checkAndLeave(t);
+			functionDeclared = FALSE;
+		} else {
+			analyzeChildren(&analyzeStack, t);
+			checkAndLeave(t);
+		}
+		u->tmpOffset = tmpOffset;
+		unit         = NULL;
+	}
+}
+
+/* mergeUnits reports what the units found, in order,
+ * and analyzes the variables left to it
+ */
+static void mergeUnits(void) {
+	Scope* scope = currentScope;
+	for (int i = 0; i < unitCount; i++) {
+		Unit* u = &units[i];
+		if (u->merged) {
+			currentScope = u->within;
+			declareNode(u->declaration);
+			analyzeChildren(&analyzeStack, u->declaration);
+			checkAndLeave(u->declaration);
+			continue;
+		}
+
+		for (int k = 0; k < u->errorCount; k++) pce("%s", u->errors[k]);
+		for (int k = 0; k < u->typeErrorCount; k++) deferError(u->typeErrors[k]);
+		for (int k = 0; k < u->referenceCount; k++)
+			addReference(u->references[k].symbol, u->references[k].lineNo);
+		if (u->errorCount || u->typeErrorCount) Error = TRUE;
+		tmpOffset = u->tmpOffset;
+	}
+	currentScope = scope;
+}
+
+/* analyzeUnits analyzes declarations with up to
+ * AnalyzeThreads workers. Units a worker could not
+ * start on are taken up on this thread afterwards
+ */
+static void analyzeUnits(ASTNode* declarations) {
+	unitCount = 0;
+	for (ASTNode* t = declarations; t; t = astNext(t)) unitCount++;
+	units = calloc(unitCount, sizeof(Unit));
+
+	const int workerCount = AnalyzeThreads;
+	Worker*   workers     = calloc(workerCount, sizeof(Worker));
+	bool*     started     = calloc(workerCount, sizeof(bool));
+	if (!units || !workers || !started) {
+		fprintf(stderr, "Out of memory: cannot analyze %d declarations\n", unitCount);
+		exit(1);
+	}
+	int i = 0;
+	for (ASTNode* t = declarations; t; t = astNext(t)) units[i++].declaration = t;
+
+	startUnits();
+	TypeInfo* functionType = currentFunctionType;
+
+	atomic_store(&nextUnit, 0);
+	for (int k = 0; k < workerCount; k++)
+		started[k] = pthread_create(&workers[k].thread, NULL, analyzeOnThread, &workers[k]) == 0;
+	for (int k = 0; k < workerCount; k++)
+		if (started[k]) pthread_join(workers[k].thread, NULL);
+	if (atomic_load(&nextUnit) < unitCount) {
+		Scope* scope = currentScope;
+		analyzeBodies(&workers[0]);
+		currentScope = scope;
+	}
+	for (int k = 0; k < workerCount; k++) arenaAdopt(&compileArena, &workers[k].arena);
+
+	mergeUnits();
+	currentFunctionType = functionType;
+	functionDeclared    = FALSE;
+
+	free(started);
+	free(workers);
+	free(units);
+	units = NULL;
+}
+
+void analyzeDeclarations(ASTNode* declarations) {
+	int functions = 0;
+	for (ASTNode* t = declarations; t; t = astNext(t))
+		if (t->kind == NODE_FUNCTION) functions++;
+
+	if (AnalyzeThreads > 1 && functions > 1)
+		analyzeUnits(declarations);
+	else
+		visitTree(&analyzeStack, declarations, declareNode, checkAndLeave);
+}
+
+void finishAnalysis(void) {
 	currentScope = globalScope;
+	if (TraceAnalyze) printSymbolTable(globalScope, declaredMain);
+
+	if (TraceAnalyze) fprintf(listing, "\nChecking Types...\n");
+	for (int i = 0; i < deferredErrorCount; i++) pce("%s", deferredErrors[i]);
+	if (TraceAnalyze) fprintf(listing, "\nType Checking Finished\n");
+}
+
+void analyze(ASTNode* syntaxTree) {
+	startAnalysis();
+	analyzeDeclarations(syntaxTree);
+	finishAnalysis();
 }
\ No newline at end of file
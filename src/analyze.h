@@ -6,19 +6,31 @@
 #include "ast.h"
 #include <string.h>
 
-extern Scope* globalScope;
-extern Scope* currentScope;
+extern Scope*               globalScope;
+extern _Thread_local Scope* currentScope;
 
-/* Function buildSymtab constructs the symbol
- * table by preorder traversal of the syntax tree
+/* Procedure analyze constructs the symbol table and
+ * performs type checking in a single traversal of the
+ * syntax tree: declarations are entered in preorder,
+ * types are checked in postorder. The listing and the
+ * diagnostics come out as if the symbol table had been
+ * built first and the types checked afterwards
  */
-void buildSymTab(ASTNode* syntaxTree);
+void analyze(ASTNode* syntaxTree);
 
-/* Procedure typeCheck performs type checking
- * by a postorder syntax tree traversal
+/* analyze in parts, for a program that arrives one
+ * declaration at a time: startAnalysis sets up the
+ * global scope, analyzeDeclarations analyzes a list of
+ * top-level declarations that follows the ones before,
+ * with the bodies of its functions on up to
+ * AnalyzeThreads threads, and finishAnalysis prints the
+ * symbol table and the type errors
  */
-void typeCheck(ASTNode* syntaxTree);
+void startAnalysis(void);
+void analyzeDeclarations(ASTNode* declarations);
+void finishAnalysis(void);
 
+/* name must be interned */
 void enterScope(const char* name);
 void leaveScope(ASTNode* t);
 
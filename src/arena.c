@@ -0,0 +1,135 @@
+#include "arena.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* blocks are at least this large; bigger requests get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+Arena compileArena;
+
+_Thread_local Arena* threadArena = &compileArena;
+
+static size_t alignUp(const size_t size) {
+	return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static ArenaBlock* newBlock(Arena* arena, const size_t size) {
+	/* calloc'd blocks make every allocation zero-filled,
+	 * since arena memory is never reused */
+	ArenaBlock* block = calloc(1, sizeof(ArenaBlock) + size);
+	if (!block) {
+		fprintf(stderr, "Out of memory: cannot grow arena by %zu bytes\n", size);
+		exit(1);
+	}
+	block->size = size;
+	arena->bytesReserved += sizeof(ArenaBlock) + size;
+	arena->blockCount++;
+	return block;
+}
+
+void* arenaAlloc(Arena* arena, size_t size) {
+	size = alignUp(size ? size : 1);
+	arena->allocations++;
+	arena->bytesAllocated += size;
+
+	ArenaBlock* block = arena->blocks;
+	if (!block || block->size - block->used < size) {
+		if (size > ARENA_BLOCK_SIZE / 4) {
+			/* keep bumping the current block, link the big one behind it */
+			ArenaBlock* big = newBlock(arena, size);
+			big->used       = size;
+			if (block) {
+				big->next   = block->next;
+				block->next = big;
+			} else {
+				arena->blocks = big;
+			}
+			return big->data;
+		}
+		block         = newBlock(arena, ARENA_BLOCK_SIZE);
+		block->next   = arena->blocks;
+		arena->blocks = block;
+	}
+
+	void* result = block->data + block->used;
+	block->used += size;
+	return result;
+}
+
+void* arenaGrow(Arena* arena, void* old, const size_t oldSize, const size_t newSize) {
+	if (!old) return arenaAlloc(arena, newSize);
+	if (newSize <= oldSize) return old;
+
+	ArenaBlock*  block   = arena->blocks;
+	const size_t oldUsed = alignUp(oldSize ? oldSize : 1);
+	const size_t newUsed = alignUp(newSize);
+	if (block && (char*) old + oldUsed == block->data + block->used &&
+	    block->used - oldUsed + newUsed <= block->size) {
+		block->used += newUsed - oldUsed;
+		arena->bytesAllocated += newUsed - oldUsed;
+		return old;
+	}
+
+	void* result = arenaAlloc(arena, newSize);
+	memcpy(result, old, oldSize);
+	return result;
+}
+
+char* arenaStrdup(Arena* arena, const char* str) {
+	if (!str) return NULL;
+	const size_t length = strlen(str) + 1;
+	char*        copy   = arenaAlloc(arena, length);
+	memcpy(copy, str, length);
+	return copy;
+}
+
+char* arenaFormat(Arena* arena, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	const int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	char* str = arenaAlloc(arena, length + 1);
+	va_start(args, format);
+	vsnprintf(str, length + 1, format, args);
+	va_end(args);
+	return str;
+}
+
+void arenaAdopt(Arena* arena, Arena* other) {
+	if (!other->blocks) return;
+
+	/* behind the current block, which keeps bumping */
+	ArenaBlock* last = other->blocks;
+	while (last->next) last = last->next;
+	if (arena->blocks) {
+		last->next          = arena->blocks->next;
+		arena->blocks->next = other->blocks;
+	} else {
+		arena->blocks = other->blocks;
+	}
+	arena->allocations += other->allocations;
+	arena->bytesAllocated += other->bytesAllocated;
+	arena->bytesReserved += other->bytesReserved;
+	arena->blockCount += other->blockCount;
+	memset(other, 0, sizeof(*other));
+}
+
+void arenaRelease(Arena* arena) {
+	ArenaBlock* block = arena->blocks;
+	while (block) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	memset(arena, 0, sizeof(*arena));
+}
+
+void arenaPrintStats(const Arena* arena, const char* name, FILE* file) {
+	fprintf(file, "%s arena: %zu allocations, %zu bytes allocated, %zu bytes reserved in %zu blocks\n",
+	        name, arena->allocations, arena->bytesAllocated, arena->bytesReserved,
+	        arena->blockCount);
+}
@@ -0,0 +1,82 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* An Arena is a bump allocator: objects are carved
+ * out of large zero-filled blocks and are never freed
+ * one by one. arenaRelease frees everything at once.
+ */
+typedef struct ArenaBlock {
+	struct ArenaBlock* next;
+	size_t             size; /* usable bytes in data */
+	size_t             used;
+	_Alignas(max_align_t) char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock* blocks; /* current block first */
+
+	/* allocation counters */
+	size_t allocations;    /* number of objects handed out */
+	size_t bytesAllocated; /* bytes requested by callers */
+	size_t bytesReserved;  /* bytes obtained from malloc */
+	size_t blockCount;
+} Arena;
+
+/* compileArena holds every AST node, symbol, scope
+ * and message string of one compilation. Types and
+ * identifiers are interned and live longer
+ */
+extern Arena compileArena;
+
+/* threadArena is where this thread allocates what
+ * belongs in compileArena. A worker thread points it at
+ * an arena of its own, which compileArena adopts once
+ * the worker is done
+ */
+extern _Thread_local Arena* threadArena;
+
+/* Function arenaAlloc returns size bytes of zeroed
+ * memory, aligned for any object type. It never
+ * returns NULL: running out of memory is fatal
+ */
+void* arenaAlloc(Arena* arena, size_t size);
+
+/* Function arenaGrow resizes an array allocated from
+ * arena, in place when it is the latest allocation.
+ * The first oldSize bytes are preserved
+ */
+void* arenaGrow(Arena* arena, void* old, size_t oldSize, size_t newSize);
+
+/* Function arenaStrdup copies a string into arena */
+char* arenaStrdup(Arena* arena, const char* str);
+
+/* Function arenaFormat formats a string into arena, as
+ * sprintf does
+ */
+char* arenaFormat(Arena* arena, const char* format, ...);
+
+/* Procedure arenaAdopt moves the blocks of other into
+ * arena, to be freed with it, and leaves other empty
+ */
+void arenaAdopt(Arena* arena, Arena* other);
+
+/* Procedure arenaRelease frees all memory of arena
+ * and resets its counters
+ */
+void arenaRelease(Arena* arena);
+
+/* Procedure arenaPrintStats prints the allocation
+ * counters of arena to file
+ */
+void arenaPrintStats(const Arena* arena, const char* name, FILE* file);
+
+/* typed allocation helpers */
+#define ARENA_NEW(arena, T) ((T*) arenaAlloc((arena), sizeof(T)))
+#define ARENA_NEW_ARRAY(arena, T, count) ((T*) arenaAlloc((arena), sizeof(T) * (count)))
+#define ARENA_GROW_ARRAY(arena, T, old, oldCount, newCount)                                        \
+	((T*) arenaGrow((arena), (old), sizeof(T) * (oldCount), sizeof(T) * (newCount)))
+
+#endif
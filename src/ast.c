@@ -4,26 +4,41 @@
 
 #include "ast.h"
 
+#include <arena.h>
 #include <globals.h>
+#include <intern.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-ASTNode* createNode(const int kind) {
-	ASTNode* node = (ASTNode*) malloc(sizeof(ASTNode));
+ASTNode** nodePages = NULL;
 
-	if (node == NULL) {
-		fprintf(stderr, "Failed to allocate memory for ASTNode\n");
-		return NULL;
+static uint32_t pageCount = 0;
+static NodeId   nextId    = 0;
+static NodeId   highId    = 0; /* nextId before the latest release */
+
+NodeId createNode(const int kind, const int lineNo) {
+	if (nextId == 0 || (nextId & (NODE_PAGE_SIZE - 1)) == 0) {
+		if ((nextId >> NODE_PAGE_BITS) == pageCount) {
+			nodePages = ARENA_GROW_ARRAY(&compileArena, ASTNode*, nodePages, pageCount, pageCount + 1);
+			nodePages[pageCount++] = ARENA_NEW_ARRAY(&compileArena, ASTNode, NODE_PAGE_SIZE);
+		}
+		if (nextId == 0) nextId = 1; /* index 0 is NO_NODE */
 	}
 
+	const NodeId id   = nextId++;
+	ASTNode*     node = astNode(id);
+
 	node->kind        = kind;
-	node->children[0] = NULL;
-	node->children[1] = NULL;
-	node->children[2] = NULL;
-	node->next        = NULL;
+	node->children[0] = NO_NODE;
+	node->children[1] = NO_NODE;
+	node->children[2] = NO_NODE;
+	node->next        = NO_NODE;
 	node->resultType  = NULL;
 	node->symbol      = NULL;
-	node->lineNo      = lineno;
+	node->offset      = 0;
+	node->storage     = STORAGE_NONE;
+	node->registers   = 0;
+	node->lineNo      = lineNo;
 
 	switch (kind) {
 		case NODE_VARIABLE:
@@ -40,43 +55,42 @@ ASTNode* createNode(const int kind) {
 			node->data.constValue = 0;
 			break;
 		case NODE_BLOCK:
-			node->data.symbol.name = "block";
+			node->data.symbol.name = nameBlock;
 			node->data.symbol.type = NULL;
 			break;
 		default:
 			break;
 	}
 
-	return node;
+	return id;
 }
 
-void destroyNode(ASTNode* node) {
-	if (!node) return;
-
-	for (int i = 0; i < 3; i++) {
-		if (node->children[i]) {
-			destroyNode(node->children[i]);
-		}
-	}
-
-	if (node->next) destroyNode(node->next);
+size_t nodeCount(void) {
+	const NodeId high = highId > nextId ? highId : nextId;
+	return high ? high - 1 : 0;
+}
 
-	if ((node->kind == NODE_VARIABLE || node->kind == NODE_FUNCTION || node->kind == NODE_CALL ||
-	     node->kind == NODE_IDENTIFIER) &&
-	    node->data.symbol.name) {
-		free((char*) node->data.symbol.name);
-	}
+void releaseNodes(void) {
+	nodePages = NULL;
+	pageCount = 0;
+	nextId    = 0;
+	highId    = 0;
+}
 
-	if (node->data.symbol.type) destroyType(node->data.symbol.type);
+NodeId nodeMark(void) {
+	return nextId;
+}
 
-	free(node);
+void releaseNodesFrom(const NodeId mark) {
+	if (nextId > highId) highId = nextId;
+	nextId = mark;
 }
 
-void addChild(ASTNode* parent, ASTNode* child) {
+void addChild(ASTNode* parent, const NodeId child) {
 	if (!parent || !child) return;
 
 	for (int i = 0; i < 3; i++) {
-		if (parent->children[i] == NULL) {
+		if (parent->children[i] == NO_NODE) {
 			parent->children[i] = child;
 			return;
 		}
@@ -84,11 +98,38 @@ void addChild(ASTNode* parent, ASTNode* child) {
 	fprintf(stderr, "Failed to add child to ASTNode\n");
 }
 
-void addSibling(ASTNode* node, ASTNode* sibling) {
+void addSibling(ASTNode* node, const NodeId sibling) {
 	if (!node || !sibling) return;
 
 	ASTNode* current = node;
-	while (current->next != NULL) current = current->next;
+	while (current->next != NO_NODE) current = astNext(current);
 
 	current->next = sibling;
-}
\ No newline at end of file
+}
+
+NodeList emptyList(void) {
+	const NodeList list = {NO_NODE, NO_NODE};
+	return list;
+}
+
+NodeList appendNode(NodeList list, const NodeId node) {
+	if (!node) return list;
+
+	if (list.tail)
+		astNode(list.tail)->next = node;
+	else
+		list.head = node;
+
+	list.tail = node;
+	while (astNode(list.tail)->next != NO_NODE) list.tail = astNode(list.tail)->next;
+	return list;
+}
+
+NodeList concatLists(NodeList first, const NodeList second) {
+	if (!second.head) return first;
+	if (!first.head) return second;
+
+	astNode(first.tail)->next = second.head;
+	first.tail                = second.tail;
+	return first;
+}
@@ -5,25 +5,53 @@
 /* ast.h = Abstract Syntax Tree declarations */
 #ifndef AST_H
 #define AST_H
+#include <stddef.h>
+#include <stdint.h>
 #include <symtab.h>
 
-typedef struct ASTNode {
-	enum {
-		NODE_PROGRAM    = 1,
-		NODE_FUNCTION   = 2,
-		NODE_VARIABLE   = 3,
-		NODE_IF         = 4,
-		NODE_WHILE      = 5,
-		NODE_RETURN     = 6,
-		NODE_ASSIGN     = 7,
-		NODE_CALL       = 8,
-		NODE_OPERATOR   = 9,
-		NODE_CONSTANT   = 10,
-		NODE_IDENTIFIER = 11,
-		NODE_PARAM      = 12,
-		NODE_BLOCK      = 13
-	} kind;
+typedef enum {
+	NODE_PROGRAM    = 1,
+	NODE_FUNCTION   = 2,
+	NODE_VARIABLE   = 3,
+	NODE_IF         = 4,
+	NODE_WHILE      = 5,
+	NODE_RETURN     = 6,
+	NODE_ASSIGN     = 7,
+	NODE_CALL       = 8,
+	NODE_OPERATOR   = 9,
+	NODE_CONSTANT   = 10,
+	NODE_IDENTIFIER = 11,
+	NODE_PARAM      = 12,
+	NODE_BLOCK      = 13
+} NodeKind;
+
+typedef enum {
+	OP_PLUS  = 267,
+	OP_MINUS = 268,
+	OP_TIMES = 269,
+	OP_OVER  = 270,
+	OP_LT    = 271,
+	OP_GT    = 272,
+	OP_LEQ   = 273,
+	OP_GEQ   = 274,
+	OP_EQ    = 275,
+	OP_NEQ   = 276
+} OperatorKind;
+
+/* StorageClass tells code generation how to address
+ * the symbol of a node: off GP at the outer level of
+ * the program, off FP inside functions
+ */
+typedef enum { STORAGE_NONE, STORAGE_GLOBAL, STORAGE_FRAME } StorageClass;
 
+/* Nodes are stored contiguously, in creation order, in
+ * pages that never move, and refer to each other by
+ * 32-bit index. NO_NODE (0) is the null index.
+ */
+typedef uint32_t NodeId;
+#define NO_NODE 0
+
+typedef struct ASTNode {
 	union {
 		struct {
 			const char* name;
@@ -31,35 +59,86 @@ typedef struct ASTNode {
 		} symbol;
 
 		struct {
-			enum {
-				OP_PLUS  = 267,
-				OP_MINUS = 268,
-				OP_TIMES = 269,
-				OP_OVER  = 270,
-				OP_LT    = 271,
-				OP_GT    = 272,
-				OP_LEQ   = 273,
-				OP_GEQ   = 274,
-				OP_EQ    = 275,
-				OP_NEQ   = 276
-			} operator;
-
-			int constValue;
+			OperatorKind operator;
+			int          constValue;
 		};
 	} data;
 
-	struct ASTNode* children[3];
-	struct ASTNode* next;
-
 	TypeInfo* resultType;
-	Symbol*   symbol;
-	int       lineNo;
+
+	/* declarations and uses of names are resolved once,
+	 * by the analyzer, and code generation reads these */
+	Symbol* symbol;
+	int     offset; /* symbol->offset */
+
+	NodeId  children[3];
+	NodeId  next;
+	int     lineNo;
+	uint8_t kind;      /* a NodeKind */
+	uint8_t storage;   /* a StorageClass */
+	uint8_t registers; /* of an operator: registers its code needs besides AC (analyze.c) */
 } ASTNode;
 
-/* AST functions */
-ASTNode* createNode(int kind);
-void     destroyNode(ASTNode* node);
-void     addChild(ASTNode* parent, ASTNode* child);
-void     addSibling(ASTNode* node, ASTNode* sibling);
+/* NodeList is a chain of siblings that also knows its
+ * last node, so the parser appends to lists in O(1)
+ */
+typedef struct NodeList {
+	NodeId head;
+	NodeId tail;
+} NodeList;
+
+#define NODE_PAGE_BITS 12
+#define NODE_PAGE_SIZE (1u << NODE_PAGE_BITS)
+
+/* page table of the node store, see astNode */
+extern ASTNode** nodePages;
+
+/* Function astNode returns the node with index id,
+ * NULL for NO_NODE
+ */
+static inline ASTNode* astNode(const NodeId id) {
+	return id ? &nodePages[id >> NODE_PAGE_BITS][id & (NODE_PAGE_SIZE - 1)] : NULL;
+}
+
+/* Functions astChild and astNext follow the links of t */
+static inline ASTNode* astChild(const ASTNode* t, const int i) {
+	return astNode(t->children[i]);
+}
+
+static inline ASTNode* astNext(const ASTNode* t) {
+	return astNode(t->next);
+}
+
+/* Function astSimpleOperand is TRUE of a constant or a
+ * scalar variable, which code generation loads straight
+ * into any register
+ */
+static inline int astSimpleOperand(const ASTNode* t) {
+	if (t->kind == NODE_CONSTANT) return 1;
+	return t->kind == NODE_IDENTIFIER && t->data.symbol.type && t->data.symbol.type->arraySize < 0;
+}
+
+/* AST functions
+ * pages live in compileArena; releaseNodes forgets them
+ * and must follow each arenaRelease of compileArena.
+ * nodeCount is the most nodes there have been at once
+ */
+NodeId createNode(int kind, int lineNo);
+size_t nodeCount(void);
+void   releaseNodes(void);
+
+/* nodeMark and releaseNodesFrom take back the nodes
+ * created after a mark, whose slots are then reused by
+ * the next nodes created. Nothing may refer to them
+ */
+NodeId nodeMark(void);
+void   releaseNodesFrom(NodeId mark);
+void   addChild(ASTNode* parent, NodeId child);
+void   addSibling(ASTNode* node, NodeId sibling);
+
+/* list functions; NO_NODE or an empty list is ignored */
+NodeList emptyList(void);
+NodeList appendNode(NodeList list, NodeId node);
+NodeList concatLists(NodeList first, NodeList second);
 
 #endif // AST_H
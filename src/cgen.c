@@ -1,136 +1,390 @@
 #include "cgen.h"
 #include "analyze.h"
+#include "arena.h"
 #include "code.h"
 #include "globals.h"
 #include "hash.h"
+#include "intern.h"
+#include "peephole.h"
+#include "util.h"
+#include "visit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 
 /* tmpOffset is the memory offset for temps
    It is decremented each time a temp is
    stored, and incremeted when loaded again
 */
-static int  tmpOffset    = initFO;
-static int  mainLocation = 3;
-static bool paramsEvaluation;
-static bool isFirstFunction = TRUE;
-
-/* prototype for internal recursive code generator */
-static void cGen(ASTNode* tree);
-
-static bool blockAfterFunction = FALSE;
-
-static int getSymbolOffset(ASTNode* t, bool onlyCurrentScope) {
-	const Symbol* symbol = onlyCurrentScope ? findSymbolInScope(currentScope, t->data.symbol.name)
-	                                        : findSymbol(currentScope, t->data.symbol.name);
-	return symbol ? symbol->offset : -1;
+static _Thread_local int  tmpOffset    = initFO;
+static int                mainLocation = 3;
+static _Thread_local bool paramsEvaluation;
+static bool               isFirstFunction = TRUE;
+
+/* comments are formatted into codeArena; a worker
+ * points it at an arena of its own */
+static _Thread_local Arena* codeArena = &compileArena;
+
+/* the stack of cGen, kept for the next program */
+static VisitStack codeStack;
+
+/* Parallel code generation (CodeThreads > 1). The
+ * bodies of the functions are generated first, each by
+ * whichever worker thread takes it next, into records
+ * located relative to the body (code.h). Linking is
+ * then the usual generation of the program, in order,
+ * on this thread, except that the body of a function
+ * is replayed where the function lands, relinking its
+ * return addresses and calls
+ */
+typedef struct Body {
+	ASTNode*    function;
+	CodeRecord* records;
+	int         count;
+	int         size;
+	int         tmpOffset; /* as the body leaves it */
+} Body;
+
+typedef struct Worker {
+	pthread_t thread;
+	Arena     strings; /* the comments of its bodies */
+} Worker;
+
+static Body*      bodies = NULL; /* of the declarations being generated, in order */
+static int        bodyCount;
+static int        linkedBodies;
+static atomic_int nextBody;
+static Worker*    workers;
+static int        workerCount;
+
+/* names were resolved by the analyzer (see resolve in
+ * analyze.c), so addresses come from the nodes */
+static int symbolOffset(const ASTNode* t) {
+	return t->symbol ? t->offset : -1;
 }
 
 static void processOperand(ASTNode* t) {
 	switch (t->kind) {
 		case NODE_CONSTANT:
-			emitRM("LDC", AC, t->data.constValue, 0, "load const");
+			emitRM(TM_LDC, AC, t->data.constValue, 0, "load const");
 			break;
 
 		case NODE_IDENTIFIER:
 			if (t->data.symbol.type->arraySize >= 0) {
-				ASTNode* indexNode = t->children[0];
-				int      loc       = getSymbolOffset(t, FALSE);
-				if (currentScope == globalScope) {
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("LD", AC, loc, GP, "get vector's address (global)");
+				ASTNode* indexNode = astChild(t, 0);
+				int      loc       = symbolOffset(t);
+				if (t->storage == STORAGE_GLOBAL) {
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_LD, AC, loc, GP, "get vector's address (global)");
 				} else {
-					emitRM("LD", AC, loc - MAX_MEMORY, FP, "get vector's address (local)");
+					emitRM(TM_LD, AC, loc - MAX_MEMORY, FP, "get vector's address (local)");
 				}
 
 				if (indexNode->kind == NODE_CONSTANT) {
 					const int index = indexNode->data.constValue;
-					emitRM("LDC", AC1, index, 0, "load constant index");
+					emitRM(TM_LDC, AC1, index, 0, "load constant index");
 				} else {
-					loc = getSymbolOffset(indexNode, FALSE);
-					emitRM("LD", AC1, loc - MAX_MEMORY, FP, "load index");
+					loc = symbolOffset(indexNode);
+					emitRM(TM_LD, AC1, loc - MAX_MEMORY, FP, "load index");
 				}
-				emitRM("LDC", R3, 1, 0, "load constant 1");
-				emitRO("ADD", AC1, AC1, R3, "adjust array index");
-				emitRO("SUB", AC, AC, AC1, "compute address of array element");
-				emitRM("LD", AC, 0, AC, "load value from array element");
+				emitRM(TM_LDC, R3, 1, 0, "load constant 1");
+				emitRO(TM_ADD, AC1, AC1, R3, "adjust array index");
+				emitRO(TM_SUB, AC, AC, AC1, "compute address of array element");
+				emitRM(TM_LD, AC, 0, AC, "load value from array element");
 			} else {
-				int loc = getSymbolOffset(t, FALSE);
-				if (currentScope == globalScope) {
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("LD", AC, loc, GP, "get variable's value (global)");
+				int loc = symbolOffset(t);
+				if (t->storage == STORAGE_GLOBAL) {
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_LD, AC, loc, GP, "get variable's value (global)");
 				} else {
-					emitRM("LD", AC, loc - MAX_MEMORY, FP, "get variable's value (local)");
+					emitRM(TM_LD, AC, loc - MAX_MEMORY, FP, "get variable's value (local)");
 				}
 			}
 			break;
 
-		case NODE_OPERATOR:
-			cGen(t);
+		default:
+			emitComment("Unsupported operand type");
 			break;
+	}
+}
 
+/* Procedure emitOperator combines the operands in
+ * registers left and right with op into AC
+ */
+static void emitOperator(const OperatorKind op, const int left, const int right) {
+	switch (op) {
+		case OP_PLUS:
+			emitRO(TM_ADD, AC, left, right, "op +");
+			break;
+		case OP_MINUS:
+			emitRO(TM_SUB, AC, left, right, "op -");
+			break;
+		case OP_TIMES:
+			emitRO(TM_MUL, AC, left, right, "op *");
+			break;
+		case OP_OVER:
+			emitRO(TM_DIV, AC, left, right, "op /");
+			break;
+		case OP_LT:
+			emitRO(TM_SUB, AC, left, right, "op <");
+			emitRM(TM_JLT, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
+		case OP_GT:
+			emitRO(TM_SUB, AC, left, right, "op >");
+			emitRM(TM_JGT, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
+		case OP_LEQ:
+			emitRO(TM_SUB, AC, left, right, "op <=");
+			emitRM(TM_JLE, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
+		case OP_GEQ:
+			emitRO(TM_SUB, AC, left, right, "op >=");
+			emitRM(TM_JGE, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
+		case OP_NEQ:
+			emitRO(TM_SUB, AC, left, right, "op !=");
+			emitRM(TM_JNE, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
+		case OP_EQ:
+			emitRO(TM_SUB, AC, left, right, "op ==");
+			emitRM(TM_JEQ, AC, 2, PC, "br if true");
+			emitRM(TM_LDC, AC, 0, AC, "false case");
+			emitRM(TM_LDA, PC, 1, PC, "unconditional jmp");
+			emitRM(TM_LDC, AC, 1, AC, "true case");
+			break;
 		default:
-			emitComment("Unsupported operand type");
+			emitComment("BUG: Unknown operator");
 			break;
 	}
 }
 
-static void generate(ASTNode* tree) {
-	ASTNode *p1, *p2, *p3;
-	int      savedLoc1, savedLoc2, currentLoc;
+/* Register temporaries (RegisterTemporaries). The
+ * operand of an operator generated first is held in
+ * AC1 or R3 while the other is generated into AC, or
+ * pushed on the frame when both are taken. R4 is
+ * left for a simple right operand, an array index and
+ * a temporary loaded back. The operand needing more
+ * registers (ASTNode.registers) goes first, which is
+ * free to choose since operands have no side effects
+ */
+static const int holdRegisters[] = {AC1, R3};
+#define HOLD_REGISTERS 2
+
+/* the holdRegisters in use, from the first */
+static _Thread_local int heldRegisters;
+
+/* Procedure loadOperand loads operand t into reg,
+ * using R4 for an array index
+ */
+static void loadOperand(ASTNode* t, const int reg) {
+	if (t->kind == NODE_CONSTANT) {
+		emitRM(TM_LDC, reg, t->data.constValue, 0, "load const");
+		return;
+	}
+	if (t->kind != NODE_IDENTIFIER) {
+		emitComment("Unsupported operand type");
+		return;
+	}
+
+	int loc = symbolOffset(t);
+	if (t->data.symbol.type->arraySize < 0) {
+		if (t->storage == STORAGE_GLOBAL) {
+			emitRM(TM_LDC, GP, 0, 0, "load GP");
+			emitRM(TM_LD, reg, loc, GP, "get variable's value (global)");
+		} else {
+			emitRM(TM_LD, reg, loc - MAX_MEMORY, FP, "get variable's value (local)");
+		}
+		return;
+	}
+
+	ASTNode* indexNode = astChild(t, 0);
+	if (t->storage == STORAGE_GLOBAL) {
+		emitRM(TM_LDC, GP, 0, 0, "load GP");
+		emitRM(TM_LD, reg, loc, GP, "get vector's address (global)");
+	} else {
+		emitRM(TM_LD, reg, loc - MAX_MEMORY, FP, "get vector's address (local)");
+	}
+
+	/* element i lies i + 1 below the address */
+	if (indexNode->kind == NODE_CONSTANT) {
+		const int index = indexNode->data.constValue;
+		emitRM(TM_LD, reg, -(index + 1), reg, "load value from array element");
+	} else {
+		loc = symbolOffset(indexNode);
+		emitRM(TM_LD, R4, loc - MAX_MEMORY, FP, "load index");
+		emitRO(TM_SUB, reg, reg, R4, "compute address of array element");
+		emitRM(TM_LD, reg, -1, reg, "load value from array element");
+	}
+}
+
+/* descend moves frame to its next step, to be taken
+ * once the code of the list at t has been generated
+ */
+static bool descend(VisitStack* stack, VisitFrame* frame, ASTNode* t) {
+	frame->step++;
+	visitPush(stack, t);
+	return TRUE;
+}
+
+/* operand loads t into AC and moves frame to its next
+ * step. Only operators need a visit of their own
+ */
+static bool operand(VisitStack* stack, VisitFrame* frame, ASTNode* t) {
+	if (t && t->kind != NODE_OPERATOR) {
+		if (RegisterTemporaries)
+			loadOperand(t, AC);
+		else
+			processOperand(t);
+		t = NULL;
+	}
+	return descend(stack, frame, t);
+}
+
+/* Function generateOperator takes the next step of
+ * an operator with register temporaries. saved[0] is
+ * where the operand generated first waits: a hold
+ * register, FP for the frame, or R4 when the right one
+ * is simple and is loaded at the end. saved[1] is TRUE
+ * when the left operand ends up in AC, as when the
+ * right one goes first
+ */
+static bool generateOperator(VisitStack* stack, VisitFrame* frame) {
+	ASTNode* tree  = frame->node;
+	ASTNode* left  = astChild(tree, 0);
+	ASTNode* right = astChild(tree, 1);
+	ASTNode* first;
+
+	switch (frame->step) {
+		case 0:
+			if (TraceCode) emitComment("-> Op");
+			if (astSimpleOperand(right)) {
+				frame->saved[0] = R4;
+				frame->saved[1] = TRUE;
+				frame->step     = 1;
+				return operand(stack, frame, left);
+			}
+
+			frame->saved[1] = (right->kind == NODE_OPERATOR ? right->registers : 0) >
+			                  (left->kind == NODE_OPERATOR ? left->registers : 0);
+			first           = frame->saved[1] ? right : left;
+			if (heldRegisters == HOLD_REGISTERS || !astSimpleOperand(first))
+				return operand(stack, frame, first);
+
+			frame->saved[0] = holdRegisters[heldRegisters++];
+			loadOperand(first, frame->saved[0]);
+			frame->step = 1;
+			return operand(stack, frame, frame->saved[1] ? left : right);
+
+		case 1:
+			if (heldRegisters == HOLD_REGISTERS) {
+				frame->saved[0] = FP;
+				emitRM_Temp(TM_ST, AC, tmpOffset--, FP,
+				            frame->saved[1] ? "op: push right" : "op: push left");
+			} else {
+				frame->saved[0] = holdRegisters[heldRegisters++];
+				emitRM(TM_LDA, frame->saved[0], 0, AC,
+				       frame->saved[1] ? "op: hold right" : "op: hold left");
+			}
+			return operand(stack, frame, frame->saved[1] ? left : right);
+	}
+
+	int held = frame->saved[0];
+	if (held == R4) {
+		loadOperand(right, R4);
+	} else if (held == FP) {
+		held = R4;
+		emitRM_Temp(TM_LD, R4, ++tmpOffset, FP,
+		            frame->saved[1] ? "op: load right" : "op: load left");
+	} else {
+		heldRegisters--;
+	}
+
+	if (frame->saved[1])
+		emitOperator(tree->data.operator, AC, held);
+	else
+		emitOperator(tree->data.operator, held, AC);
+	if (TraceCode) emitComment("<- Op");
+	return FALSE;
+}
+
+/* generate takes the next step in generating the code
+ * of frame->node. It returns FALSE when the node is
+ * done and TRUE when it has pushed the visit of a
+ * subtree whose code comes before its next step
+ */
+static bool generate(VisitStack* stack, VisitFrame* frame) {
+	ASTNode* tree = frame->node;
+	ASTNode* p1;
+	int      savedLoc1, currentLoc;
 	int      loc;
+	emitSourceLine(tree->lineNo);
 	switch (tree->kind) {
 		// Done
 		case NODE_BLOCK:
-			if (!blockAfterFunction)
-				enterScope(tree->data.symbol.name);
-			else
-				blockAfterFunction = FALSE;
-			cGen(tree->children[0]);
+			if (frame->step == 0) return descend(stack, frame, astChild(tree, 0));
 			break;
 
 		// Done
 		case NODE_FUNCTION: {
-			enterScope(tree->data.symbol.name);
-			blockAfterFunction = TRUE;
-			char* name         = strdup(tree->data.symbol.name);
-			p1                 = tree->children[0];
-			p2                 = tree->children[1];
-
-			if (TraceCode) {
-				char msg[30];
-				sprintf(msg, "-> Init Function (%s)", name);
-				emitComment(msg);
-			}
-
-			int initLocation = emitSkip(0);
-			if (isFirstFunction) {
-				mainLocation    = emitSkip(1);
-				isFirstFunction = FALSE;
-				hashInsert(name, mainLocation + 1);
-			} else {
-				hashInsert(name, initLocation);
+			const char* name = tree->data.symbol.name;
+
+			switch (frame->step) {
+				case 0: {
+					if (TraceCode) emitComment(arenaFormat(codeArena, "-> Init Function (%s)", name));
+
+					int initLocation = emitSkip(0);
+					if (isFirstFunction) {
+						mainLocation    = emitHold(TM_LDA, "jump to main");
+						isFirstFunction = FALSE;
+						hashInsert(name, mainLocation + 1);
+					} else {
+						hashInsert(name, initLocation);
+					}
+
+					tmpOffset = initFO;
+					if (name == nameMain) {
+						savedLoc1 = emitSkip(0);
+						emitBackup(mainLocation);
+						if (savedLoc1 == 3)
+							emitRM_Abs(TM_LDA, PC, savedLoc1 + 1, "jump to main");
+						else
+							emitRM_Abs(TM_LDA, PC, savedLoc1, "jump to main");
+						emitRestore();
+					} else {
+						emitRM(TM_ST, AC, retFO, FP, "store return address");
+					}
+					if (bodies) {
+						const Body* body = &bodies[linkedBodies++];
+						replayRecords(body->records, body->count, body->size);
+						tmpOffset = body->tmpOffset;
+						break;
+					}
+					return descend(stack, frame, astChild(tree, 0));
+				}
+				case 1:
+					return descend(stack, frame, astChild(tree, 1));
 			}
 
-			tmpOffset = initFO;
-			if (strcmp(tree->data.symbol.name, "main") == 0) {
-				savedLoc1 = emitSkip(0);
-				emitBackup(mainLocation);
-				if (savedLoc1 == 3)
-					emitRM_Abs("LDA", PC, savedLoc1 + 1, "jump to main");
-				else
-					emitRM_Abs("LDA", PC, savedLoc1, "jump to main");
-				emitRestore();
-
-				if (p1) cGen(p1);
-				if (p2) cGen(p2);
-			} else {
-				emitRM("ST", AC, retFO, FP, "store return address");
-				if (p1) cGen(p1);
-				if (p2) cGen(p2);
-				if (tree->data.symbol.type->returnType == TYPE_VOID) {
-					emitRM("LDA", AC1, ofpFO, FP, "save current FP into AC1");
-					emitRM("LD", FP, ofpFO, FP, "restore old FP");
-					emitRM("LD", PC, retFO, AC1, "return to caller");
-				}
+			if (name != nameMain && tree->data.symbol.type->returnType == TYPE_VOID) {
+				emitRM(TM_LDA, AC1, ofpFO, FP, "save current FP into AC1");
+				emitRM(TM_LD, FP, ofpFO, FP, "restore old FP");
+				emitRM(TM_LD, PC, retFO, AC1, "return to caller");
 			}
 
 			if (TraceCode) emitComment("<- Function");
@@ -145,20 +399,20 @@ static void generate(ASTNode* tree) {
 			}
 
 			// Global variable
-			if (currentScope == globalScope) {
+			if (tree->storage == STORAGE_GLOBAL) {
 				if (isArray) {
-					loc = getSymbolOffset(tree, TRUE);
-					emitRM("LDC", AC, loc, 0, "load global vector");
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("ST", AC, loc, GP, "store global vector");
+					loc = symbolOffset(tree);
+					emitRM(TM_LDC, AC, loc, 0, "load global vector");
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_ST, AC, loc, GP, "store global vector");
 				} else {
 					tmpOffset--;
 				}
 				// Local variable
 			} else {
 				if (isArray) {
-					emitRM("LDA", AC, tmpOffset, FP, "load local vector");
-					emitRM("ST", AC, tmpOffset, FP, "store local vector");
+					emitRM(TM_LDA, AC, tmpOffset, FP, "load local vector");
+					emitRM(TM_ST, AC, tmpOffset, FP, "store local vector");
 					tmpOffset -= tree->data.symbol.type->arraySize + 1;
 				} else {
 					tmpOffset--;
@@ -182,33 +436,33 @@ static void generate(ASTNode* tree) {
 			if (TraceCode) emitComment("-> Id");
 
 			if (tree->data.symbol.type->arraySize >= 0) {
-				p1  = tree->children[0];
-				loc = getSymbolOffset(tree, FALSE);
-				if (currentScope == globalScope) {
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("LD", AC, loc, GP, "get vector's address (global)");
+				p1  = astChild(tree, 0);
+				loc = symbolOffset(tree);
+				if (tree->storage == STORAGE_GLOBAL) {
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_LD, AC, loc, GP, "get vector's address (global)");
 				} else {
-					emitRM("LD", AC, loc - MAX_MEMORY, FP, "get vector's address (local)");
+					emitRM(TM_LD, AC, loc - MAX_MEMORY, FP, "get vector's address (local)");
 				}
 
 				if (p1 && p1->kind == NODE_CONSTANT) {
 					const int index = p1->data.constValue;
-					emitRM("LDC", AC1, index, 0, "load constant index");
+					emitRM(TM_LDC, AC1, index, 0, "load constant index");
 				} else if (p1) {
-					loc = getSymbolOffset(p1, FALSE);
-					emitRM("LD", AC1, loc - MAX_MEMORY, FP, "load index");
+					loc = symbolOffset(p1);
+					emitRM(TM_LD, AC1, loc - MAX_MEMORY, FP, "load index");
 				}
-				emitRM("LDC", R3, 1, 0, "load constant 1");
-				emitRO("ADD", AC1, AC1, R3, "adjust array index");
-				emitRO("SUB", AC, AC, AC1, "compute address of array element");
-				emitRM("LD", AC, 0, AC, "load value from array element");
+				emitRM(TM_LDC, R3, 1, 0, "load constant 1");
+				emitRO(TM_ADD, AC1, AC1, R3, "adjust array index");
+				emitRO(TM_SUB, AC, AC, AC1, "compute address of array element");
+				emitRM(TM_LD, AC, 0, AC, "load value from array element");
 			} else {
-				loc = getSymbolOffset(tree, FALSE);
-				if (currentScope == globalScope) {
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("LD", AC, loc, GP, "get variable's value (global)");
+				loc = symbolOffset(tree);
+				if (tree->storage == STORAGE_GLOBAL) {
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_LD, AC, loc, GP, "get variable's value (global)");
 				} else {
-					emitRM("LD", AC, loc - MAX_MEMORY, FP, "get variable's value (local)");
+					emitRM(TM_LD, AC, loc - MAX_MEMORY, FP, "get variable's value (local)");
 				}
 			}
 
@@ -216,77 +470,77 @@ static void generate(ASTNode* tree) {
 			break;
 
 		case NODE_CALL: {
-			if (TraceCode) {
-				char msg[30];
-				sprintf(msg, "-> Function Call (%s)", tree->data.symbol.name);
-				emitComment(msg);
-			}
+			const char* name = tree->data.symbol.name;
 
-			p1 = tree->children[0];
-			if (strcmp(tree->data.symbol.name, "output") == 0) {
-				cGen(p1);
-				emitRO("OUT", AC, 0, 0, "print value");
-				break;
-			}
-			if (strcmp(tree->data.symbol.name, "input") == 0) {
-				emitRO("IN", AC, 0, 0, "read value");
+			if (frame->step == 0) {
+				if (TraceCode) emitComment(arenaFormat(codeArena, "-> Function Call (%s)", name));
+
+				if (name == nameOutput) return descend(stack, frame, astChild(tree, 0));
+				if (name == nameInput) {
+					emitRO(TM_IN, AC, 0, 0, "read value");
+					break;
+				}
+				frame->saved[0] = tmpOffset;
+				emitRM(TM_ST, FP, tmpOffset, FP, "store FP");
+				tmpOffset -= 2;
+
+				paramsEvaluation = TRUE;
+				frame->cursor    = astChild(tree, 0);
+			} else if (name == nameOutput) {
+				emitRO(TM_OUT, AC, 0, 0, "print value");
 				break;
+			} else {
+				emitRM(TM_ST, AC, tmpOffset--, FP, "store parameter");
+				frame->cursor = astNext(frame->cursor);
 			}
-			const int tmp = tmpOffset;
-			emitRM("ST", FP, tmpOffset, FP, "store FP");
-			tmpOffset -= 2;
-
-			paramsEvaluation = TRUE;
-			while (p1) {
-				cGen(p1);
-				emitRM("ST", AC, tmpOffset--, FP, "store parameter");
-				p1 = p1->next;
+
+			// one step per argument
+			if (frame->cursor) {
+				frame->step = 1;
+				visitPush(stack, frame->cursor);
+				return TRUE;
 			}
 			paramsEvaluation = FALSE;
-			tmpOffset        = tmp;
+			tmpOffset        = frame->saved[0];
 
-			emitRM("LDA", FP, tmpOffset, FP, "load FP with parameters");
+			emitRM(TM_LDA, FP, tmpOffset, FP, "load FP with parameters");
 			savedLoc1 = emitSkip(0);
-			emitRM("LDC", AC, savedLoc1 + 2, 0, "load AC with return address");
-			const int firstLoc = hashSearch(tree->data.symbol.name);
-			emitRM_Abs("LDA", PC, firstLoc, "jump to function");
+			emitRM_Loc(TM_LDC, AC, savedLoc1 + 2, 0, "load AC with return address");
+			const int firstLoc = hashSearch(name);
+			emitRM_Call(TM_LDA, PC, name, firstLoc, "jump to function");
 
-			if (TraceCode) {
-				char msg[30];
-				sprintf(msg, "<- Function Call (%s)", tree->data.symbol.name);
-				emitComment(msg);
-			}
+			if (TraceCode) emitComment(arenaFormat(codeArena, "<- Function Call (%s)", name));
 			break;
 		}
 
 		// Done
 		case NODE_IF:
-			if (TraceCode) emitComment("-> If");
-
-			p1 = tree->children[0];
-			p2 = tree->children[1];
-			p3 = tree->children[2];
-
-			// Condition
-			cGen(p1);
-			emitComment("if: jump to else belongs here");
-			savedLoc1 = emitSkip(1);
-
-			// If body
-			cGen(p2);
-			emitComment("if: jump to end belongs here");
-			savedLoc2 = emitSkip(1);
-
-			currentLoc = emitSkip(0);
-			emitBackup(savedLoc1);
-			emitRM_Abs("JEQ", AC, savedLoc2 + 1, "if: jmp to else");
-			emitRestore();
-
-			// Else body
-			if (p3) cGen(p3);
+			switch (frame->step) {
+				case 0:
+					if (TraceCode) emitComment("-> If");
+
+					// Condition
+					return descend(stack, frame, astChild(tree, 0));
+				case 1:
+					emitComment("if: jump to else belongs here");
+					frame->saved[0] = emitSkip(1);
+
+					// If body
+					return descend(stack, frame, astChild(tree, 1));
+				case 2:
+					emitComment("if: jump to end belongs here");
+					frame->saved[1] = emitSkip(1);
+
+					emitBackup(frame->saved[0]);
+					emitRM_Abs(TM_JEQ, AC, frame->saved[1] + 1, "if: jmp to else");
+					emitRestore();
+
+					// Else body
+					return descend(stack, frame, astChild(tree, 2));
+			}
 			currentLoc = emitSkip(0);
-			emitBackup(savedLoc2);
-			emitRM_Abs("LDA", PC, currentLoc, "jmp to end");
+			emitBackup(frame->saved[1]);
+			emitRM_Abs(TM_LDA, PC, currentLoc, "jmp to end");
 			emitRestore();
 
 			if (TraceCode) emitComment("<- If");
@@ -294,23 +548,25 @@ static void generate(ASTNode* tree) {
 
 		// Done
 		case NODE_WHILE:
-			if (TraceCode) emitComment("-> while");
-
-			p1        = tree->children[0];
-			p2        = tree->children[1];
-			savedLoc1 = emitSkip(0);
-			emitComment("repeat: jump after body comes back here");
-
-			// Condition
-			cGen(p1);
-			savedLoc2 = emitSkip(1);
-			emitComment("while: jump to end belongs here");
-			// Body
-			cGen(p2);
-			emitRM_Abs("LDA", PC, savedLoc1, "while: jmp back to start of body");
+			switch (frame->step) {
+				case 0:
+					if (TraceCode) emitComment("-> while");
+
+					frame->saved[0] = emitSkip(0);
+					emitComment("repeat: jump after body comes back here");
+
+					// Condition
+					return descend(stack, frame, astChild(tree, 0));
+				case 1:
+					frame->saved[1] = emitSkip(1);
+					emitComment("while: jump to end belongs here");
+					// Body
+					return descend(stack, frame, astChild(tree, 1));
+			}
+			emitRM_Abs(TM_LDA, PC, frame->saved[0], "while: jmp back to start of body");
 			currentLoc = emitSkip(0);
-			emitBackup(savedLoc2);
-			emitRM_Abs("JEQ", AC, currentLoc, "while: jmp to end");
+			emitBackup(frame->saved[1]);
+			emitRM_Abs(TM_JEQ, AC, currentLoc, "while: jmp to end");
 			emitRestore();
 
 			if (TraceCode) emitComment("<- while");
@@ -318,41 +574,40 @@ static void generate(ASTNode* tree) {
 
 		// Done
 		case NODE_ASSIGN:
-			if (TraceCode) emitComment("-> assign");
+			if (frame->step == 0) {
+				if (TraceCode) emitComment("-> assign");
+				return descend(stack, frame, astChild(tree, 1));
+			}
 
-			p1 = tree->children[0];
-			p2 = tree->children[1];
+			p1 = astChild(tree, 0);
 			if (p1->data.symbol.type->arraySize >= 0) {
-				if (p2) cGen(p2);
-
-				if (currentScope == globalScope) {
-					loc = getSymbolOffset(p1, FALSE);
-					emitRM("LDC", GP, 0, 0, "load GP");
-					emitRM("LD", AC1, loc, GP, "assign: get vector base address");
+				if (p1->storage == STORAGE_GLOBAL) {
+					loc = symbolOffset(p1);
+					emitRM(TM_LDC, GP, 0, 0, "load GP");
+					emitRM(TM_LD, AC1, loc, GP, "assign: get vector base address");
 				} else {
-					loc = getSymbolOffset(p1, FALSE);
-					emitRM("LD", AC1, loc - MAX_MEMORY, FP, "assign: get vector base address");
+					loc = symbolOffset(p1);
+					emitRM(TM_LD, AC1, loc - MAX_MEMORY, FP, "assign: get vector base address");
 				}
 
-				ASTNode* indexNode = p1->children[0];
+				ASTNode* indexNode = astChild(p1, 0);
 				if (indexNode->kind == NODE_CONSTANT) {
 					const int index = indexNode->data.constValue;
-					emitRM("LDC", R3, index, 0, "assign: load constant index");
+					emitRM(TM_LDC, R3, index, 0, "assign: load constant index");
 				} else {
-					const int tmp = getSymbolOffset(indexNode, FALSE);
-					emitRM("LD", R3, tmp - MAX_MEMORY, FP, "assign: load index");
+					const int tmp = symbolOffset(indexNode);
+					emitRM(TM_LD, R3, tmp - MAX_MEMORY, FP, "assign: load index");
 				}
-				emitRM("LDC", R4, 1, 0, "assign: load constant 1");
-				emitRO("ADD", R3, R3, R4, "assign: adjust array index");
-				emitRO("SUB", AC1, AC1, R3, "assign: compute address of array element");
-				emitRM("ST", AC, 0, AC1, "assign: store value in array element");
+				emitRM(TM_LDC, R4, 1, 0, "assign: load constant 1");
+				emitRO(TM_ADD, R3, R3, R4, "assign: adjust array index");
+				emitRO(TM_SUB, AC1, AC1, R3, "assign: compute address of array element");
+				emitRM(TM_ST, AC, 0, AC1, "assign: store value in array element");
 			} else {
-				if (p2) cGen(p2);
-				loc = getSymbolOffset(p1, FALSE);
-				if (currentScope == globalScope) {
-					emitRM("ST", AC, loc, FP, "assign: store value");
+				loc = symbolOffset(p1);
+				if (p1->storage == STORAGE_GLOBAL) {
+					emitRM(TM_ST, AC, loc, FP, "assign: store value");
 				} else {
-					emitRM("ST", AC, loc - MAX_MEMORY, FP, "assign: store value");
+					emitRM(TM_ST, AC, loc - MAX_MEMORY, FP, "assign: store value");
 				}
 			}
 			if (TraceCode) emitComment("<- assign");
@@ -361,98 +616,37 @@ static void generate(ASTNode* tree) {
 		// Done
 		case NODE_CONSTANT:
 			if (TraceCode) emitComment("-> Const");
-			emitRM("LDC", AC, tree->data.constValue, 0, "load const");
+			emitRM(TM_LDC, AC, tree->data.constValue, 0, "load const");
 			if (TraceCode) emitComment("<- Const");
 			break;
 
 		// Done
 		case NODE_OPERATOR:
-			if (TraceCode) emitComment("-> Op");
-			p1 = tree->children[0];
-			p2 = tree->children[1];
-
-			if (p1) {
-				processOperand(p1);
-				emitRM("ST", AC, tmpOffset--, FP, "op: push left");
-			}
-
-			if (p2) {
-				processOperand(p2);
-				emitRM("LD", AC1, ++tmpOffset, FP, "op: load left");
-			}
-
-			switch (tree->data.operator) {
-				case OP_PLUS:
-					emitRO("ADD", AC, AC1, AC, "op +");
-					break;
-				case OP_MINUS:
-					emitRO("SUB", AC, AC1, AC, "op -");
-					break;
-				case OP_TIMES:
-					emitRO("MUL", AC, AC1, AC, "op *");
-					break;
-				case OP_OVER:
-					emitRO("DIV", AC, AC1, AC, "op /");
-					break;
-				case OP_LT:
-					emitRO("SUB", AC, AC1, AC, "op <");
-					emitRM("JLT", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				case OP_GT:
-					emitRO("SUB", AC, AC1, AC, "op >");
-					emitRM("JGT", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				case OP_LEQ:
-					emitRO("SUB", AC, AC1, AC, "op <=");
-					emitRM("JLE", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				case OP_GEQ:
-					emitRO("SUB", AC, AC1, AC, "op >=");
-					emitRM("JGE", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				case OP_NEQ:
-					emitRO("SUB", AC, AC1, AC, "op !=");
-					emitRM("JNE", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				case OP_EQ:
-					emitRO("SUB", AC, AC1, AC, "op ==");
-					emitRM("JEQ", AC, 2, PC, "br if true");
-					emitRM("LDC", AC, 0, AC, "false case");
-					emitRM("LDA", PC, 1, PC, "unconditional jmp");
-					emitRM("LDC", AC, 1, AC, "true case");
-					break;
-				default:
-					emitComment("BUG: Unknown operator");
-					break;
+			if (RegisterTemporaries) return generateOperator(stack, frame);
+			switch (frame->step) {
+				case 0:
+					if (TraceCode) emitComment("-> Op");
+					return operand(stack, frame, astChild(tree, 0));
+				case 1:
+					if (astChild(tree, 0)) emitRM_Temp(TM_ST, AC, tmpOffset--, FP, "op: push left");
+					return operand(stack, frame, astChild(tree, 1));
 			}
+			if (astChild(tree, 1)) emitRM_Temp(TM_LD, AC1, ++tmpOffset, FP, "op: load left");
 
+			emitOperator(tree->data.operator, AC1, AC);
 			if (TraceCode) emitComment("<- Op");
 			break;
 
 		// Done
 		case NODE_RETURN:
-			if (TraceCode) emitComment("-> return");
-
-			if (tree->children[0]) cGen(tree->children[0]);
+			if (frame->step == 0) {
+				if (TraceCode) emitComment("-> return");
+				return descend(stack, frame, astChild(tree, 0));
+			}
 
-			emitRM("LDA", AC1, ofpFO, FP, "save current FP into AC1");
-			emitRM("LD", FP, ofpFO, FP, "restore old FP");
-			emitRM("LD", PC, retFO, AC1, "return to caller");
+			emitRM(TM_LDA, AC1, ofpFO, FP, "save current FP into AC1");
+			emitRM(TM_LD, FP, ofpFO, FP, "restore old FP");
+			emitRM(TM_LD, PC, retFO, AC1, "return to caller");
 
 			if (TraceCode) emitComment("<- return");
 			break;
@@ -460,19 +654,100 @@ static void generate(ASTNode* tree) {
 		default:
 			break;
 	}
+	return FALSE;
+}
+
+/* generateStep generates a node and then, unless it is
+ * an argument being evaluated, the siblings after it
+ */
+static bool generateStep(VisitStack* stack, VisitFrame* frame, void* context) {
+	(void) context;
+	if (generate(stack, frame)) return TRUE;
+
+	ASTNode* next = astNext(frame->node);
+	if (paramsEvaluation || !next) return FALSE;
+	*frame = (VisitFrame) {.node = next};
+	return TRUE;
 }
 
-/* Procedure cGen recursively generates code by
- * tree traversal
+/* Procedure cGen generates code by tree traversal,
+ * driven by codeStack rather than recursion
  */
 static void cGen(ASTNode* tree) {
-	while (tree) {
-		generate(tree);
-		if (!paramsEvaluation)
-			tree = tree->next;
-		else
-			break;
+	visitRun(&codeStack, tree, generateStep, NULL);
+}
+
+/* generateBodies is a worker: it takes the next body
+ * until there are none left. The code of a body is
+ * what generate emits between the prologue and the
+ * epilogue of its function
+ */
+static void* generateBodies(void* argument) {
+	Worker*    worker = argument;
+	VisitStack stack  = {0};
+	Arena*     arena  = codeArena;
+	codeArena         = &worker->strings;
+
+	for (int i; (i = atomic_fetch_add(&nextBody, 1)) < bodyCount;) {
+		Body* body = &bodies[i];
+		tmpOffset  = initFO;
+		startBuffering();
+		visitRun(&stack, astChild(body->function, 0), generateStep, NULL);
+		visitRun(&stack, astChild(body->function, 1), generateStep, NULL);
+		body->count     = stopBuffering(&body->records, &body->size);
+		body->tmpOffset = tmpOffset;
+	}
+	free(stack.frames);
+	codeArena = arena;
+	return NULL;
+}
+
+/* startBodies generates the bodies of the functions
+ * among declarations on up to CodeThreads workers. A
+ * worker whose thread cannot start works on this one
+ */
+static void startBodies(ASTNode* declarations) {
+	bodyCount = 0;
+	for (ASTNode* t = declarations; t; t = astNext(t))
+		if (t->kind == NODE_FUNCTION) bodyCount++;
+	if (bodyCount < 2) return;
+
+	bodies      = calloc(bodyCount, sizeof(Body));
+	workerCount = CodeThreads < bodyCount ? CodeThreads : bodyCount;
+	workers     = calloc(workerCount, sizeof(Worker));
+	if (!bodies || !workers) {
+		free(bodies);
+		free(workers);
+		bodies = NULL;
+		return;
+	}
+	int i = 0;
+	for (ASTNode* t = declarations; t; t = astNext(t))
+		if (t->kind == NODE_FUNCTION) bodies[i++].function = t;
+
+	linkedBodies = 0;
+	atomic_store(&nextBody, 0);
+	bool* started = calloc(workerCount, sizeof(bool));
+	for (int k = 0; k < workerCount; k++) {
+		if (started)
+			started[k] = pthread_create(&workers[k].thread, NULL, generateBodies, &workers[k]) == 0;
+		if (!started || !started[k]) generateBodies(&workers[k]);
 	}
+	for (int k = 0; k < workerCount; k++)
+		if (started && started[k]) pthread_join(workers[k].thread, NULL);
+	free(started);
+}
+
+/* releaseBodies frees the bodies once they are linked.
+ * Their comments stay in the instruction buffer, so
+ * compileArena takes them over */
+static void releaseBodies(void) {
+	if (!bodies) return;
+	for (int i = 0; i < bodyCount; i++) free(bodies[i].records);
+	for (int k = 0; k < workerCount; k++) arenaAdopt(&compileArena, &workers[k].strings);
+	free(bodies);
+	free(workers);
+	bodies = NULL;
 }
 
 /**********************************************/
@@ -485,20 +760,35 @@ static void cGen(ASTNode* tree) {
  * file name as a comment in the code file
  */
 void codeGen(ASTNode* syntaxTree) {
+	startCode();
+
+	/* generate code for TINY program */
+	codeGenDeclarations(syntaxTree);
+
+	finishCode();
+}
+
+void startCode(void) {
+	hashInit();
 	emitComment("TINY Compilation to TM Code");
 
 	/* generate standard prelude */
 	emitComment("Standard prelude:");
-	emitRM("LD", MP, 0, AC, "load maxaddress from location 0");
-	emitRM("LD", FP, 0, AC, "load maxaddress from location 0");
-	emitRM("ST", AC, 0, AC, "clear location 0");
+	emitRM(TM_LD, MP, 0, AC, "load maxaddress from location 0");
+	emitRM(TM_LD, FP, 0, AC, "load maxaddress from location 0");
+	emitRM(TM_ST, AC, 0, AC, "clear location 0");
 	emitComment("End of standard prelude.");
+}
 
-	/* generate code for TINY program */
-	currentScope = globalScope;
-	cGen(syntaxTree);
+void codeGenDeclarations(ASTNode* declarations) {
+	if (CodeThreads > 1) startBodies(declarations);
+	cGen(declarations);
+	releaseBodies();
+}
 
-	/* finish */
+void finishCode(void) {
 	emitComment("End of execution.");
-	emitRO("HALT", 0, 0, 0, "");
+	emitRO(TM_HALT, 0, 0, 0, "");
+	if (Peephole) optimizeCode();
+	writeCode();
 }
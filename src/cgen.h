@@ -7,4 +7,14 @@
  */
 void codeGen(ASTNode* syntaxTree);
 
+/* codeGen in parts, for a program that arrives one
+ * declaration at a time: startCode emits the prelude,
+ * codeGenDeclarations the code of a list of analyzed
+ * top-level declarations that follows the ones before,
+ * and finishCode the end of execution
+ */
+void startCode(void);
+void codeGenDeclarations(ASTNode* declarations);
+void finishCode(void);
+
 #endif
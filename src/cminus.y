@@ -9,27 +9,45 @@
 #include "parse.h"
 #include "log.h"
 
-#ifndef _PARSE_H_
-#define _PARSE_H_
+%}
 
-ASTNode* parse(void);
+%define api.pure full
+%parse-param {ParseContext* context}
+%lex-param {ParseContext* context}
 
-#endif
+%code requires {
+#include "ast.h"
+#include "scan.h"
+#include "tokens.h"
+#include "parse.h"
 
-static char* savedName; /* for use in assignments */
-static int savedLineNo;  /* ditto */
-static int scopeId = 0;
-static ASTNode* savedTree; /* stores syntax tree for later return */
-static int yylex(void);
-int yyerror(char *);
+/* ParseContext holds all state of one parse, so the
+ * parser shares nothing between compilations
+ */
+typedef struct ParseContext {
+    ScanContext   scan;
+    TokenStream*  tokens;      /* NULL when tokens come straight from the scanner */
+    const char*   savedName;   /* for use in assignments */
+    int           savedLineNo; /* ditto */
+    NodeId        savedTree;   /* stores syntax tree for later return */
+    DeclarationFn declared;    /* NULL unless the parse streams, see parseStream */
+    void*         declaredContext;
+    NodeId        streamMark;  /* nodes after it belong to the declaration being parsed */
+} ParseContext;
+}
 
-%}
+%code {
+static int yylex(YYSTYPE* value, ParseContext* context);
+int yyerror(ParseContext* context, const char* message);
+static NodeList keepDeclaration(ParseContext* context, NodeList list, NodeId declaration);
+}
 
 %union {
     int val;
-    char *name;
+    const char *name; /* interned, see intern.h */
     TokenType token;
-    ASTNode* node;
+    NodeId node; /* an index into the node store, see ast.h */
+    NodeList list; /* list rules keep their tail for O(1) appends */
     Type type;
 }
 
@@ -46,37 +64,28 @@ int yyerror(char *);
 
 /* Type declarations */
 %type <token> soma mult relacional
-%type <node>  programa declaracao_lista declaracao
+%type <node>  programa declaracao
 %type <node>  var_declaracao fun_declaracao
-%type <node>  params param_lista param composto_decl
-%type <node>  local_declaracoes statement_lista statement
+%type <node>  params param composto_decl
+%type <node>  statement
 %type <node>  expressao_decl selecao_decl iteracao_decl retorno_decl
 %type <node>  expressao var simples_expressao soma_expressao
-%type <node>  termo fator ativacao args arg_lista
+%type <node>  termo fator ativacao args
+%type <list>  declaracao_lista param_lista local_declaracoes statement_lista arg_lista
 %type <type>  tipo_especificador
 
 %% /* Grammar rules for C- */
 
 programa:
     declaracao_lista
-        { savedTree = $1; }
+        { context->savedTree = $1.head; }
     ;
 
 declaracao_lista:
     declaracao_lista declaracao
-        {
-            ASTNode* t = $1;
-            if(t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $2;
-                $$ = $1;
-            } else {
-                $$ = $2;
-            }
-        }
+        { $$ = keepDeclaration(context, $1, $2); }
     | declaracao
-        { $$ = $1; }
+        { $$ = keepDeclaration(context, emptyList(), $1); }
     ;
 
 declaracao:
@@ -89,19 +98,19 @@ declaracao:
 var_declaracao:
     tipo_especificador ID SEMI
         { 
-            $$ = createNode(NODE_VARIABLE);
-            $$->data.symbol.name = $2;
-            $$->data.symbol.type = createType($1);
+            $$ = createNode(NODE_VARIABLE, context->scan.lineno);
+            astNode($$)->data.symbol.name = $2;
+            astNode($$)->data.symbol.type = createType($1);
         }
     | tipo_especificador ID LBRACKET NUM RBRACKET SEMI
         {
-            $$ = createNode(NODE_VARIABLE);
-            $$->data.symbol.name = $2;
-            $$->data.symbol.type = createArrayType($1, $4);
+            $$ = createNode(NODE_VARIABLE, context->scan.lineno);
+            astNode($$)->data.symbol.name = $2;
+            astNode($$)->data.symbol.type = createArrayType($1, $4);
 
-            ASTNode* sizeNode = createNode(NODE_CONSTANT);
-            sizeNode->data.constValue = $4;
-            $$->children[0] = sizeNode;
+            NodeId sizeNode = createNode(NODE_CONSTANT, context->scan.lineno);
+            astNode(sizeNode)->data.constValue = $4;
+            astNode($$)->children[0] = sizeNode;
         }
     ;
 
@@ -113,112 +122,69 @@ tipo_especificador:
     ;
 
 fun_declaracao:
-    tipo_especificador ID { savedLineNo = lineno; savedName = $2; } LPAREN params RPAREN composto_decl
+    tipo_especificador ID { context->savedLineNo = context->scan.lineno; context->savedName = $2; } LPAREN params RPAREN composto_decl
         {
-            $$ = createNode(NODE_FUNCTION);
-            $$->data.symbol.name = $2;
-            $$->lineNo = savedLineNo;
-            $$->data.symbol.type = createFunctionType(createType($1));
-            $$->children[0] = $5; // Parameters
-            $$->children[1] = $7; // Function body
+            $$ = createNode(NODE_FUNCTION, context->scan.lineno);
+            astNode($$)->data.symbol.name = $2;
+            astNode($$)->lineNo = context->savedLineNo;
+            astNode($$)->data.symbol.type = createFunctionType(createType($1));
+            astNode($$)->children[0] = $5; // Parameters
+            astNode($$)->children[1] = $7; // Function body
         }
     ;
 
 params:
     param_lista
-        { $$ = $1; }
+        { $$ = $1.head; }
     | VOID
-        { $$ = NULL; }
+        { $$ = NO_NODE; }
     ;
 
 param_lista:
     param_lista COMMA param
-        {
-            ASTNode* t = $1;
-            if (t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $3;
-                $$ = $1;
-            } else {
-                $$ = $3;
-            }
-        }
+        { $$ = appendNode($1, $3); }
     | param
-        { $$ = $1; }
+        { $$ = appendNode(emptyList(), $1); }
     ;
 
 param:
     tipo_especificador ID
         {
-            $$ = createNode(NODE_PARAM);
-            $$->data.symbol.name = $2;
-            $$->data.symbol.type = createType($1);
+            $$ = createNode(NODE_PARAM, context->scan.lineno);
+            astNode($$)->data.symbol.name = $2;
+            astNode($$)->data.symbol.type = createType($1);
         }
     | tipo_especificador ID LBRACKET RBRACKET
         {
-            $$ = createNode(NODE_PARAM);
-            $$->data.symbol.name = $2;
-            $$->data.symbol.type = createArrayType($1, 0);
+            $$ = createNode(NODE_PARAM, context->scan.lineno);
+            astNode($$)->data.symbol.name = $2;
+            astNode($$)->data.symbol.type = createArrayType($1, 0);
         }
     ;
 
 composto_decl:
     LBRACE local_declaracoes statement_lista RBRACE
         {
-            $$ = createNode(NODE_BLOCK);
-
-            char* scopeName = (char*)malloc(16);
-            sprintf(scopeName, "%s", savedName);
-            // sprintf(scopeName, "%s_%d", savedName, scopeId++);
-
-            savedName = copyString(scopeName);
-            $$->data.symbol.name = savedName;
-
-            ASTNode* t = $2;
-            if (t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $3;
-                $$->children[0] = $2 ? $2 : $3;
-            } else {
-                $$->children[0] = $3;
-            }
+            $$ = createNode(NODE_BLOCK, context->scan.lineno);
+
+            // scope name could be made unique with a per-parse counter
+            astNode($$)->data.symbol.name = context->savedName;
+            astNode($$)->children[0] = concatLists($2, $3).head;
         }
     ;
 
 local_declaracoes:
     local_declaracoes var_declaracao
-        {
-            ASTNode* t = $1;
-            if (t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $2;
-                $$ = $1;
-            } else {
-                $$ = $2;
-            }
-        }
+        { $$ = appendNode($1, $2); }
     | %empty
-        { $$ = NULL; }
+        { $$ = emptyList(); }
     ;
 
 statement_lista:
     statement_lista statement
-        {
-            ASTNode* t = $1;
-            if (t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $2;
-                $$ = $1;
-            } else {
-                $$ = $2;
-            }
-        }
+        { $$ = appendNode($1, $2); }
     | %empty
-        { $$ = NULL; }
+        { $$ = emptyList(); }
     ;
 
 statement:
@@ -238,50 +204,50 @@ expressao_decl:
     expressao SEMI
         { $$ = $1; }
     | SEMI
-        { $$ = NULL; }
+        { $$ = NO_NODE; }
     ;
 
 selecao_decl:
     IF LPAREN expressao RPAREN statement
         { 
-            $$ = createNode(NODE_IF);
-            $$->children[0] = $3;
-            $$->children[1] = $5;
+            $$ = createNode(NODE_IF, context->scan.lineno);
+            astNode($$)->children[0] = $3;
+            astNode($$)->children[1] = $5;
         }
     | IF LPAREN expressao RPAREN statement ELSE statement
         {
-            $$ = createNode(NODE_IF);
-            $$->children[0] = $3;
-            $$->children[1] = $5;
-            $$->children[2] = $7;
+            $$ = createNode(NODE_IF, context->scan.lineno);
+            astNode($$)->children[0] = $3;
+            astNode($$)->children[1] = $5;
+            astNode($$)->children[2] = $7;
         }
     ;
 
 iteracao_decl:
     WHILE LPAREN expressao RPAREN statement
         {
-            $$ = createNode(NODE_WHILE);
-            $$->children[0] = $3;
-            $$->children[1] = $5;
+            $$ = createNode(NODE_WHILE, context->scan.lineno);
+            astNode($$)->children[0] = $3;
+            astNode($$)->children[1] = $5;
         }
     ;
 
 retorno_decl:
     RETURN SEMI
-        { $$ = createNode(NODE_RETURN); }
+        { $$ = createNode(NODE_RETURN, context->scan.lineno); }
     | RETURN expressao SEMI
         { 
-            $$ = createNode(NODE_RETURN);
-            $$->children[0] = $2;
+            $$ = createNode(NODE_RETURN, context->scan.lineno);
+            astNode($$)->children[0] = $2;
         }
     ;
 
 expressao:
     var ASSIGN expressao
         {
-            $$ = createNode(NODE_ASSIGN);
-            $$->children[0] = $1;
-            $$->children[1] = $3;
+            $$ = createNode(NODE_ASSIGN, context->scan.lineno);
+            astNode($$)->children[0] = $1;
+            astNode($$)->children[1] = $3;
         }
     | simples_expressao
         { $$ = $1; }
@@ -290,24 +256,24 @@ expressao:
 var:
     ID
         {
-            $$ = createNode(NODE_IDENTIFIER);
-            $$->data.symbol.name = $1;
+            $$ = createNode(NODE_IDENTIFIER, context->scan.lineno);
+            astNode($$)->data.symbol.name = $1;
         }
     | ID LBRACKET expressao RBRACKET
         {
-            $$ = createNode(NODE_IDENTIFIER);
-            $$->data.symbol.name = $1;
-            $$->children[0] = $3;
+            $$ = createNode(NODE_IDENTIFIER, context->scan.lineno);
+            astNode($$)->data.symbol.name = $1;
+            astNode($$)->children[0] = $3;
         }
     ;
 
 simples_expressao:
     soma_expressao relacional soma_expressao
         { 
-            $$ = createNode(NODE_OPERATOR);
-            $$->children[0] = $1;
-            $$->children[1] = $3;
-            $$->data.operator = $2;
+            $$ = createNode(NODE_OPERATOR, context->scan.lineno);
+            astNode($$)->children[0] = $1;
+            astNode($$)->children[1] = $3;
+            astNode($$)->data.operator = $2;
         }
     | soma_expressao
         { $$ = $1; }
@@ -325,10 +291,10 @@ relacional:
 soma_expressao:
     soma_expressao soma termo
         {
-            $$ = createNode(NODE_OPERATOR);
-            $$->children[0] = $1;
-            $$->children[1] = $3;
-            $$->data.operator = $2;
+            $$ = createNode(NODE_OPERATOR, context->scan.lineno);
+            astNode($$)->children[0] = $1;
+            astNode($$)->children[1] = $3;
+            astNode($$)->data.operator = $2;
         }
     | termo
         { $$ = $1; }
@@ -344,10 +310,10 @@ soma:
 termo:
     termo mult fator
         { 
-            $$ = createNode(NODE_OPERATOR);
-            $$->children[0] = $1;
-            $$->children[1] = $3;
-            $$->data.operator = $2;
+            $$ = createNode(NODE_OPERATOR, context->scan.lineno);
+            astNode($$)->children[0] = $1;
+            astNode($$)->children[1] = $3;
+            astNode($$)->data.operator = $2;
         }
     | fator
         { $$ = $1; }
@@ -369,50 +335,41 @@ fator:
         { $$ = $1; }
     | NUM
         { 
-            $$ = createNode(NODE_CONSTANT);
-            $$->data.constValue = $1;
+            $$ = createNode(NODE_CONSTANT, context->scan.lineno);
+            astNode($$)->data.constValue = $1;
         }
     ;
 
 ativacao:
     ID LPAREN args RPAREN
         { 
-            $$ = createNode(NODE_CALL);
-            $$->data.symbol.name = $1;
-            $$->children[0] = $3;
+            $$ = createNode(NODE_CALL, context->scan.lineno);
+            astNode($$)->data.symbol.name = $1;
+            astNode($$)->children[0] = $3;
         }
     ;
 
 args:
     arg_lista
-        { $$ = $1; }
+        { $$ = $1.head; }
     | %empty
-        { $$ = NULL; }
+        { $$ = NO_NODE; }
     ;
 
 arg_lista:
     arg_lista COMMA expressao
-        {
-            ASTNode* t = $1;
-            if (t != NULL) {
-                while(t->next != NULL)
-                    t = t->next;
-                t->next = $3;
-                $$ = $1;
-            } else {
-                $$ = $3;
-            }
-        }
+        { $$ = appendNode($1, $3); }
     | expressao
-        { $$ = $1; }
+        { $$ = appendNode(emptyList(), $1); }
     ;
 
 %%
 
-int yyerror(char * message)
-{ pce("Syntax error at line %d: %s\n",lineno,message);
+int yyerror(ParseContext* context, const char* message)
+{ const ScanContext* scan = &context->scan;
+  pce("Syntax error at line %d: %s\n",scan->lineno,message);
   pce("Current token: ");
-  printToken(yychar,tokenString);
+  printToken(scan->token,spanText(scan->source,scan->tokenSpan),scan->tokenSpan.length);
   Error = TRUE;
   return 0;
 }
@@ -420,11 +377,50 @@ int yyerror(char * message)
 /* yylex calls getToken to make Yacc/Bison output
  * compatible with ealier versions of the TINY scanner
  */
-static int yylex(void)
-{ return getToken(); }
+static int yylex(YYSTYPE* value, ParseContext* context)
+{ if (context->tokens) return replayToken(context->tokens, &context->scan, value);
+  return getToken(&context->scan, value); }
+
+/* keepDeclaration appends a complete top-level
+ * declaration to list or, when the parse streams, hands
+ * it on and takes its nodes back. Bison reduces a
+ * declaration without looking ahead, so this happens
+ * before the next token is scanned
+ */
+static NodeList keepDeclaration(ParseContext* context, NodeList list, NodeId declaration)
+{ if (!context->declared) return appendNode(list, declaration);
+  if (declaration) context->declared(astNode(declaration), context->declaredContext);
+  releaseNodesFrom(context->streamMark);
+  return list;
+}
+
+static int runParse(ParseContext* context, const SourceText* source)
+{ TokenStream tokens;
+  if (BufferTokens) {
+    lexSource(&tokens, source);
+    context->tokens      = &tokens;
+    context->scan.source = source;
+  } else
+    initScanner(&context->scan, source);
+  const int result = yyparse(context);
+  if (BufferTokens)
+    releaseTokens(&tokens);
+  else
+    closeScanner(&context->scan);
+  return result;
+}
+
+ASTNode* parse(const SourceText* source)
+{ ParseContext context = {0};
+  runParse(&context, source);
+  return astNode(context.savedTree);
+}
 
-ASTNode* parse(void)
-{ yyparse();
-  return savedTree;
+bool parseStream(const SourceText* source, DeclarationFn declared, void* declaredContext)
+{ ParseContext context    = {0};
+  context.declared        = declared;
+  context.declaredContext = declaredContext;
+  context.streamMark      = nodeMark();
+  return runParse(&context, source) == 0;
 }
 
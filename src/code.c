@@ -1,20 +1,232 @@
 #include "code.h"
 #include "globals.h"
+#include "hash.h"
 #include "log.h"
 
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The emitter state is per thread, so bodies can be
+ * generated on threads of their own (see cgen.c) */
+
 /* TM location number for current instruction emission */
-static int emitLoc = 0;
+static _Thread_local int emitLoc = 0;
 
 /* Highest TM location emitted so far
    For use in conjunction with emitSkip,
    emitBackup, and emitRestore */
-static int highEmitLoc = 0;
+static _Thread_local int highEmitLoc = 0;
+
+/* while recording is TRUE every emission is also kept
+ * in records, located relative to recordBase, so it
+ * can be replayed elsewhere */
+static _Thread_local bool        recording = FALSE;
+static _Thread_local int         recordBase;
+static _Thread_local CodeRecord* records        = NULL;
+static _Thread_local int         recordCount    = 0;
+static _Thread_local int         recordCapacity = 0;
+
+/* while storing is FALSE emissions are only recorded;
+ * the position to go back to is kept in savedLoc */
+static _Thread_local bool storing = TRUE;
+static _Thread_local int  savedLoc, savedHighLoc;
+
+/* the instruction buffer: the instruction at each
+ * location from programBase on, and the comments with
+ * the location they come before, in the order they
+ * were emitted. Everything below writtenLoc is written
+ * out; the line of heldLoc may only be reserved */
+typedef struct CodeComment {
+	int         loc;
+	int         order;
+	const char* text;
+} CodeComment;
+
+static _Thread_local Instruction* program         = NULL;
+static _Thread_local int          programBase     = 0;
+static _Thread_local int          programCapacity = 0;
+static _Thread_local int          writtenLoc      = 0;
+static _Thread_local CodeComment* comments        = NULL;
+static _Thread_local int          commentCount    = 0;
+static _Thread_local int          commentCapacity = 0;
+static _Thread_local int          commentOrder    = 0;
+static _Thread_local int          emitLine        = 0;
+
+/* the instruction at heldLoc, heldOp with comment
+ * heldComment, is emitted after the code behind it
+ * (emitHold). While heldLength is not 0, its line is
+ * reserved at heldMark with that length */
+static _Thread_local int         heldLoc = -1;
+static _Thread_local TMOpcode    heldOp;
+static _Thread_local const char* heldComment;
+static _Thread_local bool        heldRewritable;
+static _Thread_local PrintMark   heldMark;
+static _Thread_local int         heldLength = 0;
+
+static void record(const RecordKind kind, const TMOpcode op, const int r, const int d, const int s,
+                   const char* name, const char* c) {
+	if (!recording) return;
+	if (recordCount == recordCapacity) {
+		const int   capacity = recordCapacity ? 2 * recordCapacity : 256;
+		CodeRecord* grown    = realloc(records, capacity * sizeof(CodeRecord));
+		if (!grown) {
+			fprintf(stderr, "Out of memory: cannot record %d emissions\n", capacity);
+			exit(1);
+		}
+		records        = grown;
+		recordCapacity = capacity;
+	}
+	records[recordCount++] =
+	    (CodeRecord) {kind, emitLoc - recordBase, op, r, d, s, name, c, emitLine};
+}
 
-/* Procedure emitComment prints a comment line
- * with comment c in the code file
+static const char* const opNames[] = {"",    "HALT", "IN",  "OUT", "ADD", "SUB",
+                                     "MUL", "DIV",  "LD",  "LDA", "LDC", "ST",
+                                     "JLT", "JLE",  "JGT", "JGE", "JEQ", "JNE"};
+
+/* lineFormat is the format of the line of an instruction
+ * with opcode op, given loc, op, r, d, s and comment */
+static const char* lineFormat(const TMOpcode op) {
+	if (isRegisterOnly(op)) return TraceCode ? "%3d:  %5s  %d,%d,%d \t%s\n" : "%3d:  %5s  %d,%d,%d \n";
+	return TraceCode ? "%3d:  %5s  %d,%d(%d) \t%s\n" : "%3d:  %5s  %d,%d(%d) \n";
+}
+
+static void writeInstruction(const int loc, const Instruction* i) {
+	pc(lineFormat(i->op), loc, opNames[i->op], i->r, i->d, i->s, i->comment);
+}
+
+/* reserveLine writes, in place of the line of heldLoc, a
+ * comment line as long as that line can get */
+static void reserveLine(void) {
+	heldLength = snprintf(NULL, 0, lineFormat(heldOp), heldLoc, opNames[heldOp], PC, INT_MIN, PC,
+	                      heldComment);
+	pcMark(&heldMark);
+	pc("*%*s\n", heldLength - 2, "");
+}
+
+/* rewriteLine writes the instruction at heldLoc over its
+ * reserved line, padded with spaces */
+static void rewriteLine(const Instruction* i) {
+	char* line = malloc(heldLength + 1);
+	if (!line) {
+		fprintf(stderr, "Out of memory: cannot rewrite location %d\n", heldLoc);
+		exit(1);
+	}
+	const int length = snprintf(line, heldLength + 1, lineFormat(i->op), heldLoc, opNames[i->op],
+	                            i->r, i->d, i->s, i->comment);
+	memset(line + length - 1, ' ', heldLength - length);
+	line[heldLength - 1] = '\n';
+	line[heldLength]     = '\0';
+	pcPatch(&heldMark, line);
+	free(line);
+}
+
+static int compareComments(const void* a, const void* b) {
+	const CodeComment* c1 = a;
+	const CodeComment* c2 = b;
+	if (c1->loc != c2->loc) return c1->loc < c2->loc ? -1 : 1;
+	return c1->order - c2->order;
+}
+
+/* writeThrough writes the buffered code below limit
+ * and the comments that come before limit, then drops
+ * them from the buffer */
+static void writeThrough(const int limit) {
+	/* comments are out of order only around backpatches */
+	if (commentCount > 1) qsort(comments, commentCount, sizeof(CodeComment), compareComments);
+
+	int next = 0;
+	for (int loc = writtenLoc; loc < limit; loc++) {
+		for (; next < commentCount && comments[next].loc <= loc; next++)
+			pc("* %s\n", comments[next].text);
+
+		const int index = loc - programBase;
+		if (index < programCapacity && program[index].op != TM_NONE)
+			writeInstruction(loc, &program[index]);
+		else if (loc == heldLoc && heldRewritable)
+			reserveLine();
+	}
+	for (; next < commentCount && comments[next].loc <= limit; next++)
+		pc("* %s\n", comments[next].text);
+	commentCount -= next;
+	memmove(comments, comments + next, commentCount * sizeof(CodeComment));
+	if (writtenLoc < limit) writtenLoc = limit;
+
+	/* keep the buffer to the code not written yet */
+	if (writtenLoc - programBase > programCapacity / 2) {
+		const int kept = highEmitLoc - writtenLoc;
+		memmove(program, program + (writtenLoc - programBase), kept * sizeof(Instruction));
+		memset(program + kept, 0, (programCapacity - kept) * sizeof(Instruction));
+		programBase = writtenLoc;
+	}
+}
+
+/* writeCompleted writes the code up to the first location
+ * still to be backpatched, other than a heldLoc whose
+ * line can be reserved */
+static void writeCompleted(void) {
+	int limit = writtenLoc;
+	while (limit < highEmitLoc && limit - programBase < programCapacity &&
+	       (program[limit - programBase].op != TM_NONE || (limit == heldLoc && heldRewritable)))
+		limit++;
+	writeThrough(limit);
+}
+
+/* store puts an instruction at the current location */
+static void store(const TMOpcode op, const int r, const int d, const int s, const char* c,
+                  const int flags) {
+	const Instruction instruction = {c, d, emitLine, op, r, s, flags};
+	if (!storing) {
+		/* only recorded */
+	} else if (emitLoc < writtenLoc) {
+		/* heldLoc, whose line is reserved */
+		rewriteLine(&instruction);
+	} else {
+		const int index = emitLoc - programBase;
+		if (index >= programCapacity) {
+			int capacity = programCapacity ? programCapacity : 1024;
+			while (capacity <= index) capacity *= 2;
+			Instruction* grown = realloc(program, capacity * sizeof(Instruction));
+			if (!grown) {
+				fprintf(stderr, "Out of memory: cannot hold %d instructions\n", capacity);
+				exit(1);
+			}
+			memset(grown + programCapacity, 0, (capacity - programCapacity) * sizeof(Instruction));
+			program         = grown;
+			programCapacity = capacity;
+		}
+		program[index] = instruction;
+		if (emitLoc == writtenLoc && !Peephole) {
+			emitLoc++;
+			if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+			writeCompleted();
+			return;
+		}
+	}
+	emitLoc++;
+	if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+}
+
+/* Procedure emitComment puts a comment line with
+ * comment c before the current location
  */
 void emitComment(char* c) {
-	if (TraceCode) pc("* %s\n", c);
+	if (!TraceCode) return;
+	record(RECORD_COMMENT, TM_NONE, 0, 0, 0, NULL, c);
+	if (!storing) return;
+	if (commentCount == commentCapacity) {
+		const int    capacity = commentCapacity ? 2 * commentCapacity : 1024;
+		CodeComment* grown    = realloc(comments, capacity * sizeof(CodeComment));
+		if (!grown) {
+			fprintf(stderr, "Out of memory: cannot hold %d comments\n", capacity);
+			exit(1);
+		}
+		comments        = grown;
+		commentCapacity = capacity;
+	}
+	comments[commentCount++] = (CodeComment) {emitLoc, commentOrder++, c};
 }
 
 /* Procedure emitRO emits a register-only
@@ -25,11 +237,9 @@ void emitComment(char* c) {
  * t = 2nd source register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRO(char* op, int r, int s, int t, char* c) {
-	pc("%3d:  %5s  %d,%d,%d ", emitLoc++, op, r, s, t);
-	if (TraceCode) pc("\t%s", c);
-	pc("\n");
-	if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+void emitRO(const TMOpcode op, int r, int s, int t, char* c) {
+	record(RECORD_RO, op, r, s, t, NULL, c);
+	store(op, r, s, t, c, 0);
 } /* emitRO */
 
 /* Procedure emitRM emits a register-to-memory
@@ -40,11 +250,9 @@ void emitRO(char* op, int r, int s, int t, char* c) {
  * s = the base register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM(char* op, int r, int d, int s, char* c) {
-	pc("%3d:  %5s  %d,%d(%d) ", emitLoc++, op, r, d, s);
-	if (TraceCode) pc("\t%s", c);
-	pc("\n");
-	if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+void emitRM(const TMOpcode op, int r, int d, int s, char* c) {
+	record(RECORD_RM, op, r, d, s, NULL, c);
+	store(op, r, d, s, c, 0);
 } /* emitRM */
 
 /* Function emitSkip skips "howMany" code
@@ -58,6 +266,22 @@ int emitSkip(int howMany) {
 	return i;
 } /* emitSkip */
 
+/* Function emitHold skips one code location for an
+ * instruction that is backpatched only once the code
+ * after it has been written
+ */
+int emitHold(const TMOpcode op, const char* c) {
+	PrintMark probe;
+	heldLoc        = emitLoc;
+	heldOp         = op;
+	heldComment    = c;
+	heldRewritable = !Peephole && pcMark(&probe);
+	heldLength     = 0;
+	const int loc  = emitSkip(1);
+	if (heldRewritable && writtenLoc == heldLoc) writeCompleted();
+	return loc;
+}
+
 /* Procedure emitBackup backs up to
  * loc = a previously skipped location
  */
@@ -82,10 +306,127 @@ void emitRestore(void) {
  * a = the absolute location in memory
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM_Abs(char* op, int r, int a, char* c) {
-	pc("%3d:  %5s  %d,%d(%d) ", emitLoc, op, r, a - (emitLoc + 1), PC);
-	++emitLoc;
-	if (TraceCode) pc("\t%s", c);
-	pc("\n");
-	if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+void emitRM_Abs(const TMOpcode op, int r, int a, char* c) {
+	record(RECORD_RM, op, r, a - (emitLoc + 1), PC, NULL, c);
+	store(op, r, a - (emitLoc + 1), PC, c, 0);
 } /* emitRM_Abs */
+
+/* Procedure emitRM_Loc emits a register-to-memory
+ * TM instruction whose offset is the absolute code
+ * location a, such as a return address
+ */
+void emitRM_Loc(const TMOpcode op, int r, int a, int s, char* c) {
+	record(RECORD_RM_LOC, op, r, a - recordBase, s, NULL, c);
+	store(op, r, a, s, c, CODE_ADDRESS);
+}
+
+/* Procedure emitRM_Call is emitRM_Abs to the entry a
+ * of the function called name
+ */
+void emitRM_Call(const TMOpcode op, int r, const char* name, int a, char* c) {
+	record(RECORD_RM_CALL, op, r, 0, PC, name, c);
+	store(op, r, a - (emitLoc + 1), PC, c, 0);
+}
+
+/* Procedure emitRM_Temp is emitRM on an expression
+ * temporary, a frame slot whose value is dead once it
+ * has been loaded back
+ */
+void emitRM_Temp(const TMOpcode op, int r, int d, int s, char* c) {
+	record(RECORD_RM_TEMP, op, r, d, s, NULL, c);
+	store(op, r, d, s, c, CODE_TEMPORARY);
+}
+
+void emitSourceLine(const int lineNo) {
+	emitLine = lineNo;
+}
+
+void writeCode(void) {
+	writeThrough(highEmitLoc);
+	for (int i = 0; i < commentCount; i++) pc("* %s\n", comments[i].text);
+
+	if (program) memset(program, 0, programCapacity * sizeof(Instruction));
+	programBase  = writtenLoc;
+	heldLoc      = -1;
+	heldLength   = 0;
+	commentCount = 0;
+}
+
+Instruction* codeBuffer(int* size) {
+	*size = highEmitLoc < programCapacity ? highEmitLoc : programCapacity;
+	return program;
+}
+
+void moveCode(const int* newLoc, const int size) {
+	for (int loc = 0; loc < size; loc++)
+		if (program[loc].op != TM_NONE) program[newLoc[loc]] = program[loc];
+	if (newLoc[size] < size)
+		memset(program + newLoc[size], 0, (size - newLoc[size]) * sizeof(Instruction));
+	for (int i = 0; i < commentCount; i++)
+		comments[i].loc = newLoc[comments[i].loc < size ? comments[i].loc : size];
+	emitLoc     = newLoc[size];
+	highEmitLoc = emitLoc;
+}
+
+void startRecording(void) {
+	recording   = TRUE;
+	recordBase  = emitLoc;
+	recordCount = 0;
+}
+
+int stopRecording(CodeRecord** kept, int* size) {
+	recording = FALSE;
+	*kept     = records;
+	*size     = highEmitLoc - recordBase;
+	return recordCount;
+}
+
+void startBuffering(void) {
+	savedLoc     = emitLoc;
+	savedHighLoc = highEmitLoc;
+	emitLoc      = 0;
+	highEmitLoc  = 0;
+	storing      = FALSE;
+	startRecording();
+}
+
+int stopBuffering(CodeRecord** kept, int* size) {
+	const int count = stopRecording(kept, size);
+	storing         = TRUE;
+	records         = NULL;
+	recordCapacity  = 0;
+	emitLoc         = savedLoc;
+	highEmitLoc     = savedHighLoc;
+	return count;
+}
+
+void replayRecords(const CodeRecord* kept, const int count, const int size) {
+	const int base = emitLoc;
+	for (int i = 0; i < count; i++) {
+		const CodeRecord* r = &kept[i];
+		emitLoc             = base + r->loc;
+		emitLine            = r->lineNo;
+		switch (r->kind) {
+			case RECORD_COMMENT:
+				emitComment((char*) r->comment);
+				break;
+			case RECORD_RO:
+				store(r->op, r->r, r->d, r->s, r->comment, 0);
+				break;
+			case RECORD_RM:
+				store(r->op, r->r, r->d, r->s, r->comment, 0);
+				break;
+			case RECORD_RM_LOC:
+				store(r->op, r->r, base + r->d, r->s, r->comment, CODE_ADDRESS);
+				break;
+			case RECORD_RM_CALL:
+				store(r->op, r->r, hashSearch(r->name) - (emitLoc + 1), PC, r->comment, 0);
+				break;
+			case RECORD_RM_TEMP:
+				store(r->op, r->r, r->d, r->s, r->comment, CODE_TEMPORARY);
+				break;
+		}
+	}
+	emitLoc = base + size;
+	if (highEmitLoc < emitLoc) highEmitLoc = emitLoc;
+}
@@ -1,6 +1,8 @@
 #ifndef _CODE_H_
 #define _CODE_H_
 
+#include <stdbool.h>
+
 #define AC 0
 #define AC1 1
 #define FP 2
@@ -14,10 +16,41 @@
 #define retFO -1
 #define initFO -2
 
-/* code emitting utilities */
+/* TM opcodes, the register-only ones first */
+typedef enum {
+	TM_NONE, /* at a location nothing was emitted to */
+	TM_HALT,
+	TM_IN,
+	TM_OUT,
+	TM_ADD,
+	TM_SUB,
+	TM_MUL,
+	TM_DIV,
+	TM_LD,
+	TM_LDA,
+	TM_LDC,
+	TM_ST,
+	TM_JLT,
+	TM_JLE,
+	TM_JGT,
+	TM_JGE,
+	TM_JEQ,
+	TM_JNE
+} TMOpcode;
+
+#define isRegisterOnly(op) ((op) <= TM_DIV)
 
-/* Procedure emitComment prints a comment line
- * with comment c in the code file
+/* code emitting utilities
+ * Emissions go to a buffer of instructions, by code
+ * location. The code is written out in address order
+ * as far as it is complete: up to the first location
+ * skipped for a backpatch that is still to come, other
+ * than an emitHold one. With Peephole it is all held
+ * until writeCode
+ */
+
+/* Procedure emitComment puts a comment line with
+ * comment c before the current location
  */
 void emitComment(char* c);
 
@@ -29,7 +62,7 @@ void emitComment(char* c);
  * t = 2nd source register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRO(char* opCode, int target, int firstSource, int secondSource, char* c);
+void emitRO(TMOpcode opCode, int target, int firstSource, int secondSource, char* c);
 
 /* Procedure emitRM emits a register-to-memory
  * TM instruction
@@ -39,7 +72,7 @@ void emitRO(char* opCode, int target, int firstSource, int secondSource, char* c
  * s = the base register
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM(char* opCode, int target, int offset, int base, char* c);
+void emitRM(TMOpcode opCode, int target, int offset, int base, char* c);
 
 /* Function emitSkip skips "howMany" code
  * locations for later backpatch. It also
@@ -47,6 +80,16 @@ void emitRM(char* opCode, int target, int offset, int base, char* c);
  */
 int emitSkip(int howMany);
 
+/* Function emitHold skips one code location, like
+ * emitSkip(1), for an instruction op with comment c
+ * that is backpatched only once the code after it is
+ * complete, such as the jump to main. When the output
+ * can be rewritten, a line is reserved for it in
+ * address order and the code after it is written as
+ * usual; otherwise that code is held until then
+ */
+int emitHold(TMOpcode op, const char* c);
+
 /* Procedure emitBackup backs up to
  * loc = a previously skipped location
  */
@@ -66,6 +109,127 @@ void emitRestore(void);
  * a = the absolute location in memory
  * c = a comment to be printed if TraceCode is TRUE
  */
-void emitRM_Abs(char* opCode, int target, int absoluteLoc, char* c);
+void emitRM_Abs(TMOpcode opCode, int target, int absoluteLoc, char* c);
+
+/* Procedure emitRM_Loc emits a register-to-memory
+ * TM instruction whose offset is the absolute code
+ * location a, such as a return address
+ */
+void emitRM_Loc(TMOpcode opCode, int target, int absoluteLoc, int base, char* c);
+
+/* Procedure emitRM_Call is emitRM_Abs to the entry
+ * absoluteLoc of the function called name
+ */
+void emitRM_Call(TMOpcode opCode, int target, const char* name, int absoluteLoc, char* c);
+
+/* Procedure emitRM_Temp is emitRM on an expression
+ * temporary, a frame slot whose value is dead once it
+ * has been loaded back
+ */
+void emitRM_Temp(TMOpcode opCode, int target, int offset, int base, char* c);
+
+/* Procedure emitSourceLine attributes the instructions
+ * emitted next to source line lineNo
+ */
+void emitSourceLine(int lineNo);
+
+/* the instruction buffer */
+
+
+/* what is known of an instruction beyond its operands */
+enum {
+	CODE_ADDRESS   = 1, /* d is an absolute code location (emitRM_Loc) */
+	CODE_TEMPORARY = 2  /* on an expression temporary (emitRM_Temp) */
+};
+
+/* Instruction is the instruction at one code location,
+ * op r,d,s when it is register-only and op r,d(s) when
+ * it is not
+ */
+typedef struct Instruction {
+	const char*   comment;
+	int           d;
+	int           lineNo;
+	TMOpcode      op;
+	unsigned char r, s;
+	unsigned char flags;
+} Instruction;
+
+/* Function codeBuffer returns the instruction buffer,
+ * indexed by code location, and in *size the number of
+ * locations emitted so far. Only Peephole, which holds
+ * the whole program, may use it
+ */
+Instruction* codeBuffer(int* size);
+
+/* Procedure moveCode moves the instruction, if any, and
+ * the comments at each location loc below size to
+ * location newLoc[loc], and the code position to
+ * newLoc[size]. newLoc must not decrease
+ */
+void moveCode(const int* newLoc, int size);
+
+/* Procedure writeCode writes the rest of the code
+ * emitted so far to the code listing, comments and
+ * instructions in address order, and empties the buffer
+ */
+void writeCode(void);
+
+/* code recording, for parallel code generation (cgen.c) */
+
+typedef enum {
+	RECORD_COMMENT, /* emitComment */
+	RECORD_RO,      /* emitRO, operands r, d and s */
+	RECORD_RM,      /* emitRM, or emitRM_Abs with d made pc-relative */
+	RECORD_RM_LOC,  /* emitRM_Loc, d relative to the start of the recording */
+	RECORD_RM_CALL, /* emitRM_Call to the function called name */
+	RECORD_RM_TEMP  /* emitRM_Temp */
+} RecordKind;
+
+/* CodeRecord is one emission, located relative to the
+ * start of the recording that kept it
+ */
+typedef struct CodeRecord {
+	RecordKind  kind;
+	int         loc;
+	TMOpcode    op;
+	int         r, d, s;
+	const char* name;
+	const char* comment;
+	int         lineNo;
+} CodeRecord;
+
+/* Procedure startRecording makes the emitters keep
+ * every emission from the current location on
+ */
+void startRecording(void);
+
+/* Function stopRecording ends the recording and
+ * returns the number of emissions kept, which it
+ * points *records at, and in *size the number of
+ * code locations they cover. The records are valid
+ * until the next recording starts
+ */
+int stopRecording(CodeRecord** records, int* size);
+
+/* Procedure startBuffering starts a recording, at
+ * location 0, whose emissions are not printed: code
+ * generated on a thread of its own, to be replayed
+ * into the program later
+ */
+void startBuffering(void);
+
+/* Function stopBuffering ends the recording started by
+ * startBuffering, as stopRecording does, except that
+ * the records are the caller's to free, and goes back
+ * to the location of startBuffering
+ */
+int stopBuffering(CodeRecord** records, int* size);
+
+/* Procedure replayRecords emits count records at the
+ * current location, relinking code locations and
+ * calls, and moves past the size locations they cover
+ */
+void replayRecords(const CodeRecord* records, int count, int size);
 
 #endif
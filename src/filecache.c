@@ -0,0 +1,392 @@
+#include "filecache.h"
+#include "globals.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <log.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* bump when the entry format changes */
+#define FILECACHE_FORMAT 1
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+#define ENTRY_SUFFIX ".cmc"
+
+/* the detail files of a compilation, as log.c names them */
+static const FileDestination detailFiles[] = {ER_, LEX, SYN, TAB, GEN};
+#define DETAIL_FILES (sizeof(detailFiles) / sizeof(detailFiles[0]))
+
+/* parts of an entry other than detail files */
+#define PART_STDOUT 0x100
+#define PART_STDERR 0x200
+
+/* An entry is an EntryHeader, then for each part an
+ * EntryPart followed by its bytes
+ */
+typedef struct EntryHeader {
+	char    magic[4]; /* "cmfc" */
+	int32_t format;
+	int32_t error;
+	int32_t parts;
+} EntryHeader;
+
+typedef struct EntryPart {
+	int32_t kind; /* PART_STDOUT, PART_STDERR or a FileDestination */
+	int32_t reserved;
+	int64_t length;
+} EntryPart;
+
+/* A Tee copies what is written to fd on to the original
+ * file it was pointing at, keeping a copy of the bytes
+ */
+typedef struct Tee {
+	int       fd;
+	int       original; /* dup of fd before the capture */
+	int       pipe;     /* read end of the pipe fd now writes to */
+	pthread_t thread;
+	char*     bytes;
+	size_t    length;
+	size_t    capacity;
+	bool      failed;
+} Tee;
+
+static Tee         tees[2];
+static bool        capturing = FALSE;
+static char*       entryPath = NULL;
+static const char* capturedPgm;
+static const char* capturedDetailPath;
+
+static uint64_t mix(uint64_t hash, const void* bytes, const size_t length) {
+	const unsigned char* p = bytes;
+	for (size_t i = 0; i < length; i++) hash = (hash ^ p[i]) * FNV_PRIME;
+	return hash;
+}
+
+static uint64_t mixInt(const uint64_t hash, const int64_t value) {
+	return mix(hash, &value, sizeof(value));
+}
+
+/* mixText takes the source a word at a time, which
+ * keeps hashing a large source well below compiling it
+ */
+static uint64_t mixText(uint64_t hash, const char* text, const size_t length) {
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, text + i, sizeof(word));
+		hash = (hash ^ word) * FNV_PRIME;
+	}
+	return mix(hash, text + i, length - i);
+}
+
+/* compileKey hashes everything the outputs depend on.
+ * The compiler itself is identified by its build time
+ * and, where /proc is there, by its executable
+ */
+static uint64_t compileKey(const SourceText* source, const char* pgm, const char* detailPath) {
+	uint64_t hash = mixInt(FNV_OFFSET, FILECACHE_FORMAT);
+	hash          = mix(hash, __DATE__ __TIME__, sizeof(__DATE__ __TIME__));
+
+	struct stat compiler;
+	if (stat("/proc/self/exe", &compiler) == 0) {
+		hash = mixInt(hash, compiler.st_size);
+		hash = mixInt(hash, compiler.st_mtime);
+	}
+
+	const int flags[] = {EchoSource,         TraceScan,     TraceParse, TraceAnalyze,
+	                     TraceCode,          StreamCompile, Peephole,   RegisterTemporaries,
+	                     detailPath != NULL};
+	hash = mix(hash, flags, sizeof(flags));
+	hash = mix(hash, pgm, strlen(pgm) + 1);
+	hash = mixInt(hash, source->length);
+	return mixText(hash, source->text, source->length);
+}
+
+static bool writeAll(const int fd, const char* bytes, size_t length) {
+	while (length > 0) {
+		const ssize_t written = write(fd, bytes, length);
+		if (written <= 0) return FALSE;
+		bytes += written;
+		length -= written;
+	}
+	return TRUE;
+}
+
+static void* runTee(void* argument) {
+	Tee* tee = argument;
+	char buffer[65536];
+
+	ssize_t count;
+	while ((count = read(tee->pipe, buffer, sizeof(buffer))) > 0) {
+		writeAll(tee->original, buffer, count);
+		if (tee->failed) continue;
+		if (tee->length + count > tee->capacity) {
+			const size_t capacity = 2 * (tee->length + count);
+			char*        grown    = realloc(tee->bytes, capacity);
+			if (!grown) {
+				tee->failed = TRUE;
+				continue;
+			}
+			tee->bytes    = grown;
+			tee->capacity = capacity;
+		}
+		memcpy(tee->bytes + tee->length, buffer, count);
+		tee->length += count;
+	}
+	return NULL;
+}
+
+/* startTee points fd at a pipe whose reader passes the
+ * output on, so it still shows up as it is written
+ */
+static bool startTee(Tee* tee, const int fd) {
+	int ends[2];
+	*tee = (Tee) {.fd = fd};
+	if (pipe(ends) != 0) return FALSE;
+
+	tee->original = dup(fd);
+	tee->pipe     = ends[0];
+	if (tee->original < 0 || dup2(ends[1], fd) < 0) {
+		if (tee->original >= 0) close(tee->original);
+		close(ends[0]);
+		close(ends[1]);
+		return FALSE;
+	}
+	close(ends[1]);
+	fcntl(tee->original, F_SETFD, FD_CLOEXEC);
+	fcntl(tee->pipe, F_SETFD, FD_CLOEXEC);
+
+	if (pthread_create(&tee->thread, NULL, runTee, tee) != 0) {
+		dup2(tee->original, fd);
+		close(tee->original);
+		close(tee->pipe);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* stopTee points fd back at its original file; the
+ * reader then sees the end of the pipe and finishes
+ */
+static void stopTee(Tee* tee) {
+	dup2(tee->original, tee->fd);
+	pthread_join(tee->thread, NULL);
+	close(tee->original);
+	close(tee->pipe);
+}
+
+static void freeTee(Tee* tee) {
+	free(tee->bytes);
+	tee->bytes = NULL;
+}
+
+static bool readPart(FILE* file, EntryPart* part, char** bytes) {
+	if (fread(part, sizeof(*part), 1, file) != 1 || part->length < 0) return FALSE;
+	*bytes = malloc(part->length + 1);
+	return *bytes && fread(*bytes, 1, part->length, file) == (size_t) part->length;
+}
+
+static void writeFile(const char* path, const char* bytes, const size_t length) {
+	FILE* file = fopen(path, "w");
+	if (!file) return;
+	fwrite(bytes, 1, length, file);
+	fclose(file);
+}
+
+/* serveEntry writes out every part of the entry in file.
+ * An entry is checked whole before anything is written,
+ * so a damaged one is just a miss
+ */
+static bool serveEntry(FILE* file, const char* pgm, const char* detailPath) {
+	EntryHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "cmfc", 4) != 0 ||
+	    header.format != FILECACHE_FORMAT || header.parts < 0 || header.parts > 2 + (int) DETAIL_FILES)
+		return FALSE;
+
+	EntryPart parts[2 + DETAIL_FILES];
+	char*     bytes[2 + DETAIL_FILES] = {NULL};
+	bool      complete                = TRUE;
+	for (int i = 0; complete && i < header.parts; i++) complete = readPart(file, &parts[i], &bytes[i]);
+
+	for (int i = 0; complete && i < header.parts; i++) {
+		char name[512];
+		switch (parts[i].kind) {
+			case PART_STDOUT:
+				fflush(stdout);
+				writeAll(STDOUT_FILENO, bytes[i], parts[i].length);
+				break;
+			case PART_STDERR:
+				writeAll(STDERR_FILENO, bytes[i], parts[i].length);
+				break;
+			default:
+				if (!detailPath) break;
+				detailFileName(name, sizeof(name), detailPath, pgm, parts[i].kind);
+				writeFile(name, bytes[i], parts[i].length);
+				break;
+		}
+	}
+	for (int i = 0; i < header.parts; i++) free(bytes[i]);
+
+	if (complete) Error = header.error;
+	return complete;
+}
+
+bool replayCompile(const SourceText* source, const char* pgm, const char* detailPath) {
+	const uint64_t key = compileKey(source, pgm, detailPath);
+	free(entryPath);
+	entryPath = malloc(strlen(FileCache) + 32);
+	if (!entryPath) return FALSE;
+	sprintf(entryPath, "%s/%016llx" ENTRY_SUFFIX, FileCache, (unsigned long long) key);
+
+	FILE* file = fopen(entryPath, "rb");
+	if (file) {
+		const bool hit = serveEntry(file, pgm, detailPath);
+		fclose(file);
+		if (hit) {
+			/* the modification time orders entries for eviction */
+			utimensat(AT_FDCWD, entryPath, NULL, 0);
+			return TRUE;
+		}
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	if (!startTee(&tees[0], STDOUT_FILENO)) return FALSE;
+	if (!startTee(&tees[1], STDERR_FILENO)) {
+		stopTee(&tees[0]);
+		freeTee(&tees[0]);
+		return FALSE;
+	}
+	capturing          = TRUE;
+	capturedPgm        = pgm;
+	capturedDetailPath = detailPath;
+	return FALSE;
+}
+
+static bool writePart(FILE* file, const int kind, const char* bytes, const size_t length) {
+	const EntryPart part = {kind, 0, length};
+	return fwrite(&part, sizeof(part), 1, file) == 1 &&
+	       (length == 0 || fwrite(bytes, 1, length, file) == length);
+}
+
+static bool readFile(const char* path, char** bytes, size_t* length) {
+	FILE* file = fopen(path, "rb");
+	if (!file) return FALSE;
+	struct stat info;
+	bool        read = fstat(fileno(file), &info) == 0 && (*bytes = malloc(info.st_size + 1)) != NULL;
+	if (read) {
+		*length = fread(*bytes, 1, info.st_size, file);
+		read    = *length == (size_t) info.st_size;
+		if (!read) free(*bytes);
+	}
+	fclose(file);
+	return read;
+}
+
+typedef struct CachedEntry {
+	char*  name;
+	off_t  size;
+	time_t used;
+} CachedEntry;
+
+static int leastRecentFirst(const void* a, const void* b) {
+	const CachedEntry* x = a;
+	const CachedEntry* y = b;
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/* evict removes the least recently used entries until
+ * the cache fits in FileCacheLimit
+ */
+static void evict(void) {
+	DIR* directory = opendir(FileCache);
+	if (!directory) return;
+
+	CachedEntry*   entries  = NULL;
+	size_t         count    = 0;
+	size_t         capacity = 0;
+	long long      total    = 0;
+	struct dirent* found;
+	while ((found = readdir(directory)) != NULL) {
+		const size_t length = strlen(found->d_name);
+		if (length < strlen(ENTRY_SUFFIX) ||
+		    strcmp(found->d_name + length - strlen(ENTRY_SUFFIX), ENTRY_SUFFIX) != 0)
+			continue;
+
+		struct stat info;
+		if (fstatat(dirfd(directory), found->d_name, &info, 0) != 0) continue;
+		if (count == capacity) {
+			capacity           = capacity ? 2 * capacity : 64;
+			CachedEntry* grown = realloc(entries, capacity * sizeof(CachedEntry));
+			if (!grown) break;
+			entries = grown;
+		}
+		entries[count++] = (CachedEntry) {strdup(found->d_name), info.st_size, info.st_mtime};
+		total += info.st_size;
+	}
+
+	if (total > FileCacheLimit) {
+		qsort(entries, count, sizeof(CachedEntry), leastRecentFirst);
+		for (size_t i = 0; i < count && total > FileCacheLimit; i++) {
+			if (entries[i].name && unlinkat(dirfd(directory), entries[i].name, 0) == 0)
+				total -= entries[i].size;
+		}
+	}
+	for (size_t i = 0; i < count; i++) free(entries[i].name);
+	free(entries);
+	closedir(directory);
+}
+
+void storeCompile(const int status) {
+	if (!capturing) return;
+	capturing = FALSE;
+
+	fflush(stdout);
+	fflush(stderr);
+	stopTee(&tees[0]);
+	stopTee(&tees[1]);
+	if (status != 0) {
+		freeTee(&tees[0]);
+		freeTee(&tees[1]);
+		return;
+	}
+
+	mkdir(FileCache, 0777);
+	char temporary[600];
+	snprintf(temporary, sizeof(temporary), "%s.%ld", entryPath, (long) getpid());
+	FILE* file = fopen(temporary, "wb");
+
+	char*  details[DETAIL_FILES] = {NULL};
+	size_t lengths[DETAIL_FILES] = {0};
+	bool   stored                = file && !tees[0].failed && !tees[1].failed;
+	int    parts                 = 2;
+	for (size_t i = 0; stored && capturedDetailPath && i < DETAIL_FILES; i++) {
+		char name[512];
+		detailFileName(name, sizeof(name), capturedDetailPath, capturedPgm, detailFiles[i]);
+		if (readFile(name, &details[i], &lengths[i])) parts++;
+	}
+
+	const EntryHeader header = {"cmfc", FILECACHE_FORMAT, Error, parts};
+	stored = stored && fwrite(&header, sizeof(header), 1, file) == 1 &&
+	         writePart(file, PART_STDOUT, tees[0].bytes, tees[0].length) &&
+	         writePart(file, PART_STDERR, tees[1].bytes, tees[1].length);
+	for (size_t i = 0; i < DETAIL_FILES; i++) {
+		if (details[i]) stored = stored && writePart(file, detailFiles[i], details[i], lengths[i]);
+		free(details[i]);
+	}
+	/* an entry larger than the whole cache would only evict the rest */
+	if (stored && ftell(file) > FileCacheLimit) stored = FALSE;
+	if (file && fclose(file) != 0) stored = FALSE;
+	if (!stored || rename(temporary, entryPath) != 0) unlink(temporary);
+
+	freeTee(&tees[0]);
+	freeTee(&tees[1]);
+	if (stored) evict();
+}
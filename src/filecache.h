@@ -0,0 +1,35 @@
+#ifndef _FILECACHE_H_
+#define _FILECACHE_H_
+
+#include "source.h"
+
+#include <stdbool.h>
+
+/* The file cache keeps whole compilations in the
+ * directory FileCache: what a compilation wrote to
+ * stdout, to stderr and to its detail files, under a
+ * hash of the compiler, the source bytes, the source
+ * name and the options that shape the output. Entries
+ * are written aside and renamed into place; a hit
+ * touches its entry, and the least recently used
+ * entries go when the directory outgrows FileCacheLimit.
+ */
+
+/* Function replayCompile serves the compilation of
+ * source, named pgm, from the cache. On a hit it writes
+ * the outputs, sets Error as the compilation did and
+ * returns TRUE. On a miss it starts capturing the
+ * outputs of the compilation that follows and returns
+ * FALSE. detailPath is NULL when there are no detail
+ * files
+ */
+bool replayCompile(const SourceText* source, const char* pgm, const char* detailPath);
+
+/* Procedure storeCompile ends the capture started by a
+ * miss of replayCompile, after the detail files are
+ * closed, and stores the compilation in the cache
+ * unless its exit status is not 0
+ */
+void storeCompile(int status);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _GLOBALS_H_
 #define _GLOBALS_H_
 
+#include "source.h"
+
 #include <stdio.h>
 
 #ifndef FALSE
@@ -27,12 +29,8 @@
 
 typedef int TokenType;
 
-extern FILE* source;           /* source code text file */
-extern FILE* redundant_source; /* source code text file */
-extern FILE* listing;          /* listing output text file */
-extern FILE* code;             /* code text file for TM simulator */
-
-extern int lineno; /* source line number for listing */
+extern FILE* listing; /* listing output text file */
+extern FILE* code;    /* code text file for TM simulator */
 
 /**************************************************/
 /***********   Syntax tree for parsing ************/
@@ -68,6 +66,61 @@ extern int lineno; /* source line number for listing */
  */
 extern int EchoSource;
 
+/* HandScanner = TRUE makes getToken use the
+ * hand-written scanner of handscan.c instead of
+ * the flex one
+ */
+extern int HandScanner;
+
+/* BufferTokens = TRUE makes the parser lex the whole
+ * source into a TokenStream (tokens.h) before parsing
+ * instead of asking the scanner for one token at a time
+ */
+extern int BufferTokens;
+
+/* LexThreads > 1 lets a buffered lex of a large source
+ * split it into up to that many chunks, lexed on
+ * threads of their own
+ */
+extern int LexThreads;
+
+/* StreamCompile = TRUE takes each top-level declaration
+ * through analysis and code generation as soon as it is
+ * parsed, and then frees its nodes, instead of building
+ * the syntax tree of the whole program first
+ */
+extern int StreamCompile;
+
+/* CodeThreads > 1 generates the bodies of functions on
+ * up to that many threads before linking them into the
+ * program (cgen.c)
+ */
+extern int CodeThreads;
+
+/* Peephole = TRUE runs the peephole optimizer over
+ * the generated code before it is written (peephole.h)
+ */
+extern int Peephole;
+
+/* RegisterTemporaries = TRUE keeps the operands of
+ * expressions in registers, in Sethi-Ullman order, and
+ * pushes them on the frame only when it runs out (cgen.c)
+ */
+extern int RegisterTemporaries;
+
+/* AnalyzeThreads > 1 analyzes the bodies of functions
+ * on up to that many threads, once the global scope is
+ * filled in (analyze.c)
+ */
+extern int AnalyzeThreads;
+
+/* FileCache names the directory where whole
+ * compilations are kept for later ones (filecache.h),
+ * NULL for none. FileCacheLimit caps its size in bytes
+ */
+extern const char* FileCache;
+extern long        FileCacheLimit;
+
 /* TraceScan = TRUE causes token information to be
  * printed to the listing file as each token is
  * recognized by the scanner
@@ -90,6 +143,12 @@ extern int TraceAnalyze;
  */
 extern int TraceCode;
 
+/* TraceMemory = TRUE causes the allocation counters
+ * of the compilation arena to be printed to stderr
+ * when the compilation finishes
+ */
+extern int TraceMemory;
+
 /* Error = TRUE prevents further passes if an error occurs */
 extern int Error;
 
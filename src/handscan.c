@@ -0,0 +1,231 @@
+#include "handscan.h"
+#include "intern.h"
+#include "util.h"
+
+#include <parser.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* The scanner walks the source text directly and never
+ * writes to it. Runs of blanks, letters and digits are
+ * classified 16 bytes at a time with SSE2 compares;
+ * whatever is left near the end of the text, or on
+ * machines without SSE2, is scanned a byte at a time
+ */
+
+/* the six reserved words of cminus.l, placed by a
+ * perfect hash of their first two letters and length
+ */
+typedef struct Keyword {
+	const char* word;
+	size_t      length;
+	TokenType   token;
+} Keyword;
+
+#define KEYWORD_HASH(text, length) (((text)[0] ^ ((text)[1] << 1) ^ (length)) & 15)
+
+static const Keyword keywords[16] = {
+    [9] = {"else", 4, ELSE},     [7] = {"if", 2, IF},      [6] = {"int", 3, INT},
+    [14] = {"return", 6, RETURN}, [12] = {"void", 4, VOID}, [2] = {"while", 5, WHILE},
+};
+
+static TokenType keyword(const char* text, const size_t length) {
+	if (length < 2 || length > 6) return ID;
+	const Keyword* candidate = &keywords[KEYWORD_HASH(text, length)];
+	if (candidate->length == length && memcmp(candidate->word, text, length) == 0)
+		return candidate->token;
+	return ID;
+}
+
+static int isLetter(const unsigned char c) {
+	return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
+}
+
+static int isDigit(const unsigned char c) {
+	return c >= '0' && c <= '9';
+}
+
+/* skipBlanks returns the first position from p that is
+ * not a space or a tab
+ */
+static size_t skipBlanks(const char* text, size_t p, const size_t n) {
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab   = _mm_set1_epi8('\t');
+	for (; p + 16 <= n; p += 16) {
+		const __m128i      bytes = _mm_loadu_si128((const __m128i*) (text + p));
+		const unsigned int blank = _mm_movemask_epi8(
+		    _mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)));
+		if (blank != 0xFFFF) return p + __builtin_ctz(~blank);
+	}
+#endif
+	while (p < n && (text[p] == ' ' || text[p] == '\t')) p++;
+	return p;
+}
+
+/* skipLetters returns the first position from p that
+ * is not in [a-zA-Z]
+ */
+static size_t skipLetters(const char* text, size_t p, const size_t n) {
+#if defined(__SSE2__)
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	const __m128i beforeA = _mm_set1_epi8('a' - 1);
+	const __m128i afterZ  = _mm_set1_epi8('z' + 1);
+	for (; p + 16 <= n; p += 16) {
+		/* folding to lower case maps [A-Z] onto [a-z]; bytes
+		 * above 0x7f compare as negative and drop out */
+		const __m128i lower =
+		    _mm_or_si128(_mm_loadu_si128((const __m128i*) (text + p)), caseBit);
+		const unsigned int letter = _mm_movemask_epi8(
+		    _mm_and_si128(_mm_cmpgt_epi8(lower, beforeA), _mm_cmplt_epi8(lower, afterZ)));
+		if (letter != 0xFFFF) return p + __builtin_ctz(~letter);
+	}
+#endif
+	while (p < n && isLetter(text[p])) p++;
+	return p;
+}
+
+/* skipDigits returns the first position from p that
+ * is not in [0-9]
+ */
+static size_t skipDigits(const char* text, size_t p, const size_t n) {
+#if defined(__SSE2__)
+	const __m128i before0 = _mm_set1_epi8('0' - 1);
+	const __m128i after9  = _mm_set1_epi8('9' + 1);
+	for (; p + 16 <= n; p += 16) {
+		const __m128i      bytes = _mm_loadu_si128((const __m128i*) (text + p));
+		const unsigned int digit = _mm_movemask_epi8(
+		    _mm_and_si128(_mm_cmpgt_epi8(bytes, before0), _mm_cmplt_epi8(bytes, after9)));
+		if (digit != 0xFFFF) return p + __builtin_ctz(~digit);
+	}
+#endif
+	while (p < n && isDigit(text[p])) p++;
+	return p;
+}
+
+/* countNewlines counts the '\n' bytes in [from, to) */
+static size_t countNewlines(const char* text, size_t from, const size_t to) {
+	size_t count = 0;
+#if defined(__SSE2__)
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; from + 16 <= to; from += 16) {
+		const __m128i bytes = _mm_loadu_si128((const __m128i*) (text + from));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+	}
+#endif
+	for (; from < to; from++) count += text[from] == '\n';
+	return count;
+}
+
+/* commentEnd returns the position after the comment
+ * whose body starts at p. It follows the comment rule
+ * of cminus.l exactly: the character after a '*' is
+ * consumed whether or not it is the closing '/', so
+ * the comment runs to the end of the text when it is
+ * never closed
+ */
+static size_t commentEnd(const char* text, size_t p, const size_t n) {
+	while (p < n) {
+		const char* star = memchr(text + p, '*', n - p);
+		if (!star || star + 1 >= text + n) break;
+		if (star[1] == '/') return star + 2 - text;
+		p = star + 2 - text;
+	}
+	return n;
+}
+
+/* newLines counts and echoes count source lines */
+static void newLines(ScanContext* context, size_t count) {
+	while (count--) {
+		context->lineno++;
+		printLine(context);
+	}
+}
+
+/* token ends the current lexeme after length bytes */
+static TokenType token(ScanContext* context, const TokenType kind, const size_t length) {
+	context->tokenSpan.length = length;
+	context->position         = context->tokenSpan.offset + length;
+	return kind;
+}
+
+TokenType handScan(ScanContext* context, union YYSTYPE* value) {
+	const char*  text = context->source->text;
+	const size_t n    = context->source->length;
+
+	for (;;) {
+		const size_t start        = skipBlanks(text, context->position, n);
+		context->position         = start;
+		context->tokenSpan.offset = start;
+		if (start >= n) return token(context, ENDFILE, 0);
+
+		const char c    = text[start];
+		const char next = start + 1 < n ? text[start + 1] : '\0';
+		if (isLetter(c)) {
+			const size_t    length = skipLetters(text, start + 1, n) - start;
+			const TokenType kind   = keyword(text + start, length);
+			if (kind == ID)
+				value->name = context->deferNames ? NULL : internString(text + start, length);
+			return token(context, kind, length);
+		}
+		if (isDigit(c)) {
+			/* the text after the digits is never a digit,
+			 * and the source is NUL-padded, so atoi stops
+			 * at the end of the lexeme */
+			value->val = atoi(text + start);
+			return token(context, NUM, skipDigits(text, start + 1, n) - start);
+		}
+
+		switch (c) {
+			case '\n':
+				context->position++;
+				newLines(context, 1);
+				continue;
+			case '\r':
+				if (next != '\n') return token(context, ERROR, 1);
+				context->position += 2;
+				newLines(context, 1);
+				continue;
+			case '/':
+				if (next != '*') return token(context, OVER, 1);
+				context->position = commentEnd(text, start + 2, n);
+				newLines(context, countNewlines(text, start + 2, context->position));
+				continue;
+			case '+':
+				return token(context, PLUS, 1);
+			case '-':
+				return token(context, MINUS, 1);
+			case '*':
+				return token(context, TIMES, 1);
+			case '=':
+				return next == '=' ? token(context, EQ, 2) : token(context, ASSIGN, 1);
+			case '!':
+				return next == '=' ? token(context, NEQ, 2) : token(context, ERROR, 1);
+			case '<':
+				return next == '=' ? token(context, LEQ, 2) : token(context, LT, 1);
+			case '>':
+				return next == '=' ? token(context, GEQ, 2) : token(context, GT, 1);
+			case ';':
+				return token(context, SEMI, 1);
+			case ',':
+				return token(context, COMMA, 1);
+			case '(':
+				return token(context, LPAREN, 1);
+			case ')':
+				return token(context, RPAREN, 1);
+			case '[':
+				return token(context, LBRACKET, 1);
+			case ']':
+				return token(context, RBRACKET, 1);
+			case '{':
+				return token(context, LBRACE, 1);
+			case '}':
+				return token(context, RBRACE, 1);
+			default:
+				return token(context, ERROR, 1);
+		}
+	}
+}
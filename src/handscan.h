@@ -0,0 +1,14 @@
+#ifndef _HANDSCAN_H_
+#define _HANDSCAN_H_
+
+#include "scan.h"
+
+/* Function handScan is a hand-written replacement for
+ * the flex scanner of cminus.l: it accepts the same
+ * tokens, echoes the same lines and sets the semantic
+ * value the same way. It stores the lexeme of the
+ * token in context->tokenSpan
+ */
+TokenType handScan(ScanContext* context, union YYSTYPE* value);
+
+#endif
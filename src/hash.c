@@ -3,62 +3,97 @@
 //
 
 #include "hash.h"
+#include "intern.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define SIZE 23
+/* open addressing over a power-of-two table that
+ * doubles when half full, so any number of functions
+ * fit; a free slot has a NULL key */
+#define INITIAL_SIZE 32
 
-static struct DataItem* hashArray[SIZE];
+static struct DataItem* hashArray = NULL;
+static int              size      = 0;
+static int              count     = 0;
 
-static int hash(char* key) {
-	int hashVal = 0;
-	while (*key != '\0') hashVal = (hashVal << 5) + *key++;
-	return hashVal % SIZE;
+static int hash(const char* key) {
+	return nameHash(key) & (size - 1);
 }
 
-void hashInit() {
-	for (int i = 0; i < SIZE; i++) hashArray[i] = NULL;
-}
-
-void hashInsert(char* key, int data) {
-	struct DataItem* item = malloc(sizeof(struct DataItem));
-	item->data            = data;
-	item->key             = key;
-
+static void place(const char* key, const int data) {
 	int hashIndex = hash(key);
 
-	while (hashArray[hashIndex] != NULL) {
+	while (hashArray[hashIndex].key != NULL) {
 		++hashIndex;
-		hashIndex %= SIZE;
+		hashIndex &= size - 1;
 	}
 
-	hashArray[hashIndex] = item;
+	hashArray[hashIndex].key  = key;
+	hashArray[hashIndex].data = data;
+}
+
+static void grow(void) {
+	struct DataItem* old     = hashArray;
+	const int        oldSize = size;
+
+	size      = size ? 2 * size : INITIAL_SIZE;
+	hashArray = calloc(size, sizeof(struct DataItem));
+	if (!hashArray) {
+		fprintf(stderr, "Out of memory: cannot locate %d functions\n", count);
+		exit(1);
+	}
+	for (int i = 0; i < oldSize; i++)
+		if (old[i].key) place(old[i].key, old[i].data);
+	free(old);
+}
+
+void hashInit() {
+	if (hashArray) memset(hashArray, 0, size * sizeof(struct DataItem));
+	count = 0;
+}
+
+void hashInsert(const char* key, int data) {
+	if (2 * (count + 1) > size) grow();
+	place(key, data);
+	count++;
 }
 
-int hashSearch(char* key) {
+int hashSearch(const char* key) {
+	if (!hashArray) return 1024;
 	int hashIndex = hash(key);
 
-	while (hashArray[hashIndex] != NULL) {
-		if (strcmp(hashArray[hashIndex]->key, key) == 0) return hashArray[hashIndex]->data;
+	while (hashArray[hashIndex].key != NULL) {
+		if (hashArray[hashIndex].key == key) return hashArray[hashIndex].data;
 
 		++hashIndex;
-		hashIndex %= SIZE;
+		hashIndex &= size - 1;
 	}
 
 	return 1024;
 }
 
-void hashDelete(char* key) {
+void hashDelete(const char* key) {
+	if (!hashArray) return;
 	int hashIndex = hash(key);
 
-	while (hashArray[hashIndex] != NULL) {
-		if (strcmp(hashArray[hashIndex]->key, key) == 0) {
-			free(hashArray[hashIndex]);
-			hashArray[hashIndex] = NULL;
+	while (hashArray[hashIndex].key != NULL) {
+		if (hashArray[hashIndex].key == key) {
+			hashArray[hashIndex].key = NULL;
+			count--;
+
+			/* the rest of the run may have probed past this slot */
+			int next = (hashIndex + 1) & (size - 1);
+			while (hashArray[next].key != NULL) {
+				const struct DataItem item = hashArray[next];
+				hashArray[next].key        = NULL;
+				place(item.key, item.data);
+				next = (next + 1) & (size - 1);
+			}
 			return;
 		}
 
 		++hashIndex;
-		hashIndex %= SIZE;
+		hashIndex &= size - 1;
 	}
 }
\ No newline at end of file
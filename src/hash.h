@@ -5,16 +5,17 @@
 #ifndef HASH_H
 #define HASH_H
 
-#define SIZE 23
-
+/* keys are interned names (see intern.h); hashInit
+ * empties the table and hashSearch returns 1024 for a
+ * key that is not there */
 struct DataItem {
-    char* key;
+    const char* key;
     int data;
 };
 
 void hashInit();
-void hashInsert(char* key, int data);
-int hashSearch(char* key);
-void hashDelete(char* key);
+void hashInsert(const char* key, int data);
+int hashSearch(const char* key);
+void hashDelete(const char* key);
 
 #endif // HASH_H
\ No newline at end of file
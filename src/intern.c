@@ -0,0 +1,86 @@
+#include "intern.h"
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_BUCKETS 256
+
+/* interned names outlive single compilations, so they
+ * get their own arena instead of compileArena */
+static Arena          internArena;
+static InternedName** buckets     = NULL;
+static unsigned int   bucketCount = 0; /* always a power of two */
+static unsigned int   nameCount   = 0;
+
+const char* nameMain;
+const char* nameInput;
+const char* nameOutput;
+const char* nameGlobal;
+const char* nameBlock;
+
+/* the symbol table derives its bucket order from this
+ * hash, so it must stay h * 31 + c */
+static unsigned int hashBytes(const char* text, const size_t length) {
+	unsigned int h = 0;
+	for (size_t i = 0; i < length; i++) h = h * 31 + text[i];
+	return h;
+}
+
+static void rehash(const unsigned int newCount) {
+	InternedName** newBuckets = calloc(newCount, sizeof(InternedName*));
+	if (!newBuckets) return; /* keep the old, fuller table */
+
+	for (unsigned int i = 0; i < bucketCount; i++) {
+		InternedName* name = buckets[i];
+		while (name) {
+			InternedName*      next  = name->next;
+			const unsigned int index = name->hash & (newCount - 1);
+			name->next               = newBuckets[index];
+			newBuckets[index]        = name;
+			name                     = next;
+		}
+	}
+	free(buckets);
+	buckets     = newBuckets;
+	bucketCount = newCount;
+}
+
+void internInit(void) {
+	if (!buckets) rehash(INITIAL_BUCKETS);
+	nameMain   = internCString("main");
+	nameInput  = internCString("input");
+	nameOutput = internCString("output");
+	nameGlobal = internCString("global");
+	nameBlock  = internCString("block");
+}
+
+const char* internString(const char* text, const size_t length) {
+	const unsigned int hash = hashBytes(text, length);
+
+	if (!buckets) rehash(INITIAL_BUCKETS);
+	for (InternedName* name = buckets[hash & (bucketCount - 1)]; name; name = name->next) {
+		if (name->hash == hash && name->length == length && memcmp(name->text, text, length) == 0)
+			return name->text;
+	}
+
+	InternedName* name = arenaAlloc(&internArena, sizeof(InternedName) + length + 1);
+	name->hash         = hash;
+	name->length       = length;
+	memcpy(name->text, text, length);
+	name->text[length] = '\0';
+
+	if (++nameCount > bucketCount) rehash(bucketCount * 2);
+	const unsigned int index = hash & (bucketCount - 1);
+	name->next               = buckets[index];
+	buckets[index]           = name;
+	return name->text;
+}
+
+const char* internCString(const char* text) {
+	return internString(text, strlen(text));
+}
+
+unsigned int nameHash(const char* name) {
+	return ((const InternedName*) (name - offsetof(InternedName, text)))->hash;
+}
@@ -0,0 +1,45 @@
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+
+/* Identifiers are interned: every distinct spelling is
+ * stored once, so two interned names are equal exactly
+ * when their pointers are equal. The handle is the text
+ * itself (printable as any string); its hash is stored
+ * in a header just before the text.
+ */
+typedef struct InternedName {
+	struct InternedName* next; /* chain of the intern table bucket */
+	unsigned int         hash;
+	unsigned int         length;
+	char                 text[];
+} InternedName;
+
+/* names the compiler refers to by itself */
+extern const char* nameMain;
+extern const char* nameInput;
+extern const char* nameOutput;
+extern const char* nameGlobal;
+extern const char* nameBlock;
+
+/* Procedure internInit creates the intern table and
+ * interns the names above. It must run before the
+ * first compilation
+ */
+void internInit(void);
+
+/* Function internString returns the unique interned
+ * copy of the length bytes at text
+ */
+const char* internString(const char* text, size_t length);
+
+/* Function internCString interns a NUL-terminated string */
+const char* internCString(const char* text);
+
+/* Function nameHash returns the precomputed hash of
+ * an interned name in O(1)
+ */
+unsigned int nameHash(const char* name);
+
+#endif
@@ -3,37 +3,60 @@
 /* set NO_PARSE to TRUE to get a scanner-only compiler */
 #define NO_PARSE FALSE
 /* set NO_ANALYZE to TRUE to get a parser-only compiler */
+#ifndef NO_ANALYZE
 #define NO_ANALYZE FALSE
+#endif
 
 /* set NO_CODE to TRUE to get a compiler that does not
  * generate code
  */
 #define NO_CODE FALSE
 
+/* set HAND_SCANNER to TRUE to scan with the hand-written
+ * scanner of handscan.c unless --scanner says otherwise
+ */
+#ifndef HAND_SCANNER
+#define HAND_SCANNER FALSE
+#endif
+
+#include "arena.h"
+#include "filecache.h"
+#include "intern.h"
+#include "server.h"
 #include "util.h"
 
+#include <limits.h>
 #include <log.h>
+#include <parser.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#if NO_PARSE
+#include <time.h>
 #include "scan.h"
-#else
+#include "tokens.h"
+#if !NO_PARSE
 #include "ast.h"
 #include "parse.h"
 #if !NO_ANALYZE
 #include "analyze.h"
 #if !NO_CODE
 #include "cgen.h"
+#include "code.h"
 #endif
 #endif
 #endif
 
+/* the detail outputs are named from the source file
+ * name in fixed buffers (lib/log.c)
+ */
+#define MAX_FILE_NAME 250
+
+/* the most threads a --*-threads option may ask for */
+#define MAX_THREADS 1024
+
 /* allocate global variables */
-int   lineno = 0;
-FILE* source;
 FILE* listing;
 FILE* code;
-FILE* redundant_source;
 
 /* allocate and set tracing flags */
 int EchoSource   = TRUE;
@@ -41,47 +64,46 @@ int TraceScan    = TRUE;
 int TraceParse   = TRUE;
 int TraceAnalyze = TRUE;
 int TraceCode    = TRUE;
+int TraceMemory  = FALSE;
+int HandScanner  = HAND_SCANNER;
+int BufferTokens = FALSE;
+int LexThreads   = 1;
 
-int Error = FALSE;
+int StreamCompile  = FALSE;
+int CodeThreads    = 1;
+int AnalyzeThreads = 1;
+int Peephole       = FALSE;
 
-int main(int argc, char* argv[]) {
-	ASTNode* syntaxTree;
+int RegisterTemporaries = FALSE;
 
-	//// opening sources ////
-	char pgm[120]; /* source code file name */
-	if ((argc < 2) || (argc > 3)) {
-		fprintf(stderr, "usage: %s <filename> [<detailpath>]\n", argv[0]);
-		exit(1);
-	}
-	strcpy(pgm, argv[1]);
-	if (strchr(pgm, '.') == NULL)
-		strcat(pgm, ".cm"); // if no extension is given, append .cm (c minus) to the filename
-	source = fopen(pgm, "r");
-	redundant_source =
-	    fopen(pgm, "r"); // <- use redundant_source to print whole lines in lex output
-	if (source == NULL) {
-		fprintf(stderr, "File %s not found\n", pgm);
-		exit(1);
-	}
+const char* FileCache      = NULL;
+long        FileCacheLimit = 64L << 20;
 
-	char detailpath[200];
-	if (3 == argc) {
-		strcpy(detailpath, argv[2]);
-	} else
-		strcpy(detailpath,
-		       "/tmp/"); // default detailpath is /tmp. Check there if you called by hand.
-	//// end opening sources ////
+int Error = FALSE;
 
-	listing = stdout;                           /* send messages from main() to screen */
-	initializePrinter(detailpath, pgm, LOGALL); // init logger in /lib/log.c
-	// for the lexical analysis, you might change LOGALL to LER, to generate only lex and err
-	// outputs.
+/* Function openCodeFile creates the code file of pgm,
+ * next to it, with the extension .tm
+ */
+static FILE* openCodeFile(const char* pgm) {
+	int   fnlen    = strcspn(pgm, ".");
+	char* codefile = (char*) calloc(fnlen + 4, sizeof(char));
+	strncpy(codefile, pgm, fnlen);
+	strcat(codefile, ".tm");
+	FILE* file = fopen(codefile, "w");
+	if (file == NULL) printf("Unable to open %s\n", codefile);
+	free(codefile);
+	return file;
+}
 
-	fprintf(listing, "\nTINY COMPILATION: %s\n", pgm);
-#if NO_PARSE
-	while (getToken() != ENDFILE);
-#else
-	syntaxTree = parse();
+#if !NO_PARSE
+/* Function compileTree parses source into the syntax
+ * tree of the whole program and then takes the tree
+ * through each later stage in turn. It returns the
+ * exit status
+ */
+static int compileTree(const SourceText* source, const char* pgm) {
+	int      status     = 0;
+	ASTNode* syntaxTree = parse(source);
 	doneLEXstartSYN();
 	if (TraceParse) {
 		fprintf(listing, "\nSyntax tree:\n");
@@ -90,32 +112,317 @@ int main(int argc, char* argv[]) {
 #if !NO_ANALYZE
 	doneSYNstartTAB();
 	if (!Error) {
-		if (TraceAnalyze) fprintf(listing, "\nBuilding Symbol Table...\n");
-		buildSymTab(syntaxTree);
-		if (TraceAnalyze) fprintf(listing, "\nChecking Types...\n");
-		typeCheck(syntaxTree);
-		if (TraceAnalyze) fprintf(listing, "\nType Checking Finished\n");
+		analyze(syntaxTree);
 	}
 #if !NO_CODE
 	doneTABstartGEN();
 	if (!Error) {
-		char* codefile;
-		int   fnlen = strcspn(pgm, ".");
-		codefile    = (char*) calloc(fnlen + 4, sizeof(char));
-		strncpy(codefile, pgm, fnlen);
-		strcat(codefile, ".tm");
-		code = fopen(codefile, "w");
+		code = openCodeFile(pgm);
 		if (code == NULL) {
-			printf("Unable to open %s\n", codefile);
-			exit(1);
+			status = 1;
+		} else {
+			codeGen(syntaxTree);
+			fclose(code);
 		}
-		codeGen(syntaxTree);
+	}
+#endif
+#endif
+	return status;
+}
+
+/* StreamState carries a streamed compilation from one
+ * declaration to the next
+ */
+typedef struct StreamState {
+	bool printed;    /* the syntax tree heading is out */
+	bool analyzing;  /* startAnalysis has run */
+	bool generating; /* startCode has run */
+} StreamState;
+
+/* Procedure compileDeclaration takes one declaration
+ * of a streamed parse through the later stages and
+ * gives the scanner its stage back. Every stage writes
+ * to its detail file what it would for the whole tree.
+ * Analysis starts unless there was a syntax error; code
+ * generation stops at the first error of any kind
+ */
+static void compileDeclaration(ASTNode* declaration, void* context) {
+	StreamState* state = context;
+	doneLEXstartSYN();
+	if (TraceParse) {
+		if (!state->printed) fprintf(listing, "\nSyntax tree:\n");
+		printTree(declaration);
+	}
+	state->printed = TRUE;
+#if !NO_ANALYZE
+	doneSYNstartTAB();
+	if (!state->analyzing && !Error) {
+		startAnalysis();
+		state->analyzing = TRUE;
+	}
+	if (state->analyzing) analyzeDeclarations(declaration);
+#if !NO_CODE
+	doneTABstartGEN();
+	if (!Error) {
+		if (!state->generating) startCode();
+		state->generating = TRUE;
+		codeGenDeclarations(declaration);
+	}
+#endif
+#endif
+	resumeLEX();
+}
+
+/* Function compileStream compiles source a declaration
+ * at a time, so no more than one declaration's nodes
+ * are held at once. When the program has errors, the
+ * declarations before the first one have already been
+ * through every stage; after a syntax error there is
+ * no symbol table. It returns the exit status
+ */
+static int compileStream(const SourceText* source, const char* pgm) {
+	StreamState state  = {FALSE, FALSE, FALSE};
+	const bool  parsed = parseStream(source, compileDeclaration, &state);
+	doneLEXstartSYN();
+	if (TraceParse && !state.printed) fprintf(listing, "\nSyntax tree:\n");
+#if !NO_ANALYZE
+	doneSYNstartTAB();
+	if (!state.analyzing && !Error) {
+		startAnalysis();
+		state.analyzing = TRUE;
+	}
+	if (state.analyzing && parsed) finishAnalysis();
+#if !NO_CODE
+	doneTABstartGEN();
+	if (!Error) {
+		code = openCodeFile(pgm);
+		if (code == NULL) return 1;
 		fclose(code);
+		if (!state.generating) startCode();
+		finishCode();
+	} else if (state.generating) {
+		writeCode(); /* of the declarations before the error */
 	}
 #endif
+#else
+	(void) parsed;
+#endif
+	return 0;
+}
 #endif
+
+/* Function parseOptions sets the flags of the options
+ * at the front of words and returns how many words they
+ * take, -1 when an option has a bad value
+ */
+static int parseOptions(const int count, char* words[]) {
+	int  used = 0;
+	long number;
+	while (used < count) {
+		const char* option = words[used];
+		const char* value  = used + 1 < count ? words[used + 1] : NULL;
+		if (value && strcmp(option, "--scanner") == 0) {
+			if (strcmp(value, "flex") == 0)
+				HandScanner = FALSE;
+			else if (strcmp(value, "hand") == 0)
+				HandScanner = TRUE;
+			else
+				return -1;
+			used += 2;
+		} else if (strcmp(option, "--buffer-tokens") == 0) {
+			BufferTokens = TRUE;
+			used++;
+		} else if (value && strcmp(option, "--lex-threads") == 0) {
+			/* only a buffered lex can be split */
+			BufferTokens = TRUE;
+			if (!parseNumber(value, 1, MAX_THREADS, &number)) return -1;
+			LexThreads = number;
+			used += 2;
+		} else if (value && strcmp(option, "--analyze-threads") == 0) {
+			if (!parseNumber(value, 1, MAX_THREADS, &number)) return -1;
+			AnalyzeThreads = number;
+			used += 2;
+		} else if (value && strcmp(option, "--code-threads") == 0) {
+			if (!parseNumber(value, 1, MAX_THREADS, &number)) return -1;
+			CodeThreads = number;
+			used += 2;
+		} else if (strcmp(option, "--peephole") == 0) {
+			Peephole = TRUE;
+			used++;
+		} else if (strcmp(option, "--register-temps") == 0) {
+			RegisterTemporaries = TRUE;
+			used++;
+		} else if (strcmp(option, "--stream") == 0) {
+			StreamCompile = TRUE;
+			used++;
+		} else if (value && strcmp(option, "--file-cache") == 0) {
+			FileCache = value;
+			used += 2;
+		} else if (value && strcmp(option, "--file-cache-limit") == 0) {
+			/* in megabytes */
+			if (!parseNumber(value, 1, LONG_MAX >> 20, &number)) return -1;
+			FileCacheLimit = number << 20;
+			used += 2;
+		} else
+			break;
+	}
+	return used;
+}
+
+/* Function compile runs one whole compilation of the
+ * request's source and returns the process exit status
+ */
+static int compile(const CompileRequest* request) {
+	SourceText source;
+
+	/* a server request brings the options of its client */
+	if (parseOptions(request->optionCount, request->options) != request->optionCount) {
+		fprintf(stderr, "Invalid compile options\n");
+		return 1;
+	}
+
+	//// opening sources ////
+	if (strlen(request->fileName) > MAX_FILE_NAME) {
+		fprintf(stderr, "File name too long: %.40s...\n", request->fileName);
+		return 1;
+	}
+	/* source code file name; if no extension is given, append .cm (c minus) */
+	const char* pgm = formatString("%s%s", request->fileName,
+	                               strchr(request->fileName, '.') ? "" : ".cm");
+	if (request->text)
+		sourceFromMemory(&source, request->text, request->textLength);
+	else if (!openSource(&source, pgm)) {
+		fprintf(stderr, "File %s not found\n", pgm);
+		return 1;
+	}
+	//// end opening sources ////
+
+	/* the allocation counters describe a real compilation */
+	if (FileCache && !TraceMemory && replayCompile(&source, pgm, request->detailPath)) {
+		closeSource(&source);
+#if !NO_PARSE && !NO_ANALYZE && !NO_CODE
+		if (!Error) {
+			FILE* file = openCodeFile(pgm);
+			if (file == NULL) return 1;
+			fclose(file);
+		}
+#endif
+		return 0;
+	}
+	int status = 0;
+
+	listing = stdout; /* send messages from main() to screen */
+	if (request->detailPath)
+		initializePrinter(request->detailPath, pgm, LOGALL); // init logger in /lib/log.c
+	else
+		initializePrinter("", pgm, 0); // no detail outputs, everything goes to stdout
+	// for the lexical analysis, you might change LOGALL to LER, to generate only lex and err
+	// outputs.
+
+	fprintf(listing, "\nTINY COMPILATION: %s\n", pgm);
+#if NO_PARSE
+	ScanContext scanner;
+	YYSTYPE     value;
+	initScanner(&scanner, &source);
+	while (getToken(&scanner, &value) != ENDFILE);
+	closeScanner(&scanner);
+#else
+	if (StreamCompile)
+		status = compileStream(&source, pgm);
+	else
+		status = compileTree(&source, pgm);
 #endif
-	fclose(source);
-	fclose(redundant_source);
+	closePrinter();
+	storeCompile(status);
+	closeSource(&source);
+
+	/* every node, type, symbol and name of this compilation goes at once */
+	if (TraceMemory) {
+		fprintf(stderr, "AST: %zu nodes of %zu bytes\n", nodeCount(), sizeof(ASTNode));
+		arenaPrintStats(&compileArena, "compile", stderr);
+	}
+	arenaRelease(&compileArena);
+	releaseNodes();
+	releaseScopes();
+	return status;
+}
+
+/* Function benchScanner scans the whole file with
+ * every trace off and reports the throughput of the
+ * selected scanner (see scripts/benchscan). With
+ * BufferTokens it times lexing into a TokenStream
+ */
+static int benchScanner(const char* fileName) {
+	SourceText source;
+	if (!openSource(&source, fileName)) {
+		fprintf(stderr, "File %s not found\n", fileName);
+		return 1;
+	}
+	listing    = stdout;
+	EchoSource = FALSE;
+	TraceScan  = FALSE;
+
+	struct timespec begin, end;
+	ScanContext     scanner;
+	YYSTYPE         value;
+	size_t          tokens = 0;
+	TokenStream     stream;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (BufferTokens) {
+		lexSource(&stream, &source);
+		tokens = stream.count - 1; /* not counting ENDFILE */
+	} else {
+		initScanner(&scanner, &source);
+		while (getToken(&scanner, &value) != ENDFILE) tokens++;
+		closeScanner(&scanner);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (BufferTokens) releaseTokens(&stream);
+
+	const double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	printf("%s scanner%s: %zu tokens, %zu lines, %zu bytes in %.3f s (%.1f MB/s)\n",
+	       HandScanner ? "hand" : "flex", BufferTokens ? " (buffered)" : "", tokens,
+	       source.lineCount, source.length, seconds, source.length / seconds / 1e6);
+	closeSource(&source);
 	return 0;
 }
+
+static void usage(const char* program) {
+	fprintf(stderr, "usage: %s [<options>] <filename> [<detailpath>]\n", program);
+	fprintf(stderr, "       %s [<options>] --serve <socket>\n", program);
+	fprintf(stderr, "       %s [<options>] --client <socket> <filename>|- [<detailpath>|-]\n",
+	        program);
+	fprintf(stderr, "       %s [<options>] --bench-scanner <filename>\n", program);
+	fprintf(stderr, "options: --scanner flex|hand, --buffer-tokens, --lex-threads <n>, --stream,\n");
+	fprintf(stderr, "         --analyze-threads <n>, --code-threads <n>, --peephole,\n");
+	fprintf(stderr, "         --register-temps, --file-cache <dir>,\n");
+	fprintf(stderr, "         --file-cache-limit <megabytes>\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+	const char* program = argv[0];
+	internInit(); // a server's children inherit the warm intern table
+	char**    options     = argv + 1;
+	const int optionCount = parseOptions(argc - 1, options);
+	if (optionCount < 0) usage(program);
+	argc -= optionCount;
+	argv += optionCount;
+	if (argc >= 2 && strcmp(argv[1], "--bench-scanner") == 0) {
+		if (argc != 3) usage(program);
+		return benchScanner(argv[2]);
+	}
+	if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+		if (argc != 3) usage(program);
+		return serveCompiler(argv[2], compile);
+	}
+	if (argc >= 2 && strcmp(argv[1], "--client") == 0) {
+		if ((argc < 4) || (argc > 5)) usage(program);
+		return runClient(argv[2], options, optionCount, argv[3], 5 == argc ? argv[4] : "/tmp/");
+	}
+	if ((argc < 2) || (argc > 3)) usage(program);
+
+	// default detailpath is /tmp. Check there if you called by hand.
+	const CompileRequest request = {argv[1], 3 == argc ? argv[2] : "/tmp/", NULL, 0, NULL, 0};
+	return compile(&request);
+}
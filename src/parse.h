@@ -9,9 +9,27 @@
 #ifndef _PARSE_H_
 #define _PARSE_H_
 
+#include <stdbool.h>
+
 /* Function parse returns the newly
- * constructed syntax tree
+ * constructed syntax tree of source.
+ * All parser and scanner state lives in
+ * a context local to the call
+ */
+ASTNode* parse(const SourceText* source);
+
+/* DeclarationFn receives a top-level declaration of a
+ * streamed parse as soon as it is complete
+ */
+typedef void (*DeclarationFn)(ASTNode* declaration, void* context);
+
+/* Function parseStream parses source without building
+ * the whole syntax tree: each top-level declaration is
+ * handed to declared, with context, and its nodes are
+ * released when declared returns, so the parse holds
+ * one declaration at a time. It returns FALSE when the
+ * parse stopped at a syntax error
  */
-ASTNode* parse(void);
+bool parseStream(const SourceText* source, DeclarationFn declared, void* context);
 
 #endif
@@ -0,0 +1,467 @@
+#include "peephole.h"
+#include "code.h"
+#include "globals.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* how far back a rule looks for an earlier instruction */
+#define WINDOW 8
+
+/* how many instructions, and how many branches still to
+ * follow, the search for a use of a register may take */
+#define DEAD_STEPS 64
+#define DEAD_PATHS 8
+
+/* sweeps over the code stop when one changes nothing */
+#define MAX_SWEEPS 16
+
+/* the code being optimized; a deleted instruction is
+ * TM_NONE. labels counts, for each location, the jumps
+ * and return addresses that lead there */
+static Instruction* program;
+static int          size;
+static int*         labels;
+static int          dropped;
+
+static bool isGoto(const Instruction* i) {
+	return i->op == TM_LDA && i->r == PC && i->s == PC;
+}
+
+/* isJump is TRUE of a pc-relative jump */
+static bool isJump(const Instruction* i) {
+	return isGoto(i) || (i->op >= TM_JLT && i->s == PC);
+}
+
+static bool writesPC(const Instruction* i) {
+	if (i->op >= TM_JLT) return TRUE;
+	return (i->op == TM_LD || i->op == TM_LDA || i->op == TM_LDC) && i->r == PC;
+}
+
+/* ends is TRUE of an instruction that never falls
+ * through to the next one */
+static bool ends(const Instruction* i) {
+	return i->op == TM_HALT || (writesPC(i) && i->op < TM_JLT);
+}
+
+static bool reads(const Instruction* i, const int reg) {
+	switch (i->op) {
+		case TM_OUT:
+			return i->r == reg;
+		case TM_ADD:
+		case TM_SUB:
+		case TM_MUL:
+		case TM_DIV:
+			return i->d == reg || i->s == reg;
+		case TM_LD:
+		case TM_LDA:
+			return i->s == reg;
+		case TM_ST:
+		case TM_JLT:
+		case TM_JLE:
+		case TM_JGT:
+		case TM_JGE:
+		case TM_JEQ:
+		case TM_JNE:
+			return i->r == reg || i->s == reg;
+		default:
+			return FALSE;
+	}
+}
+
+static bool writes(const Instruction* i, const int reg) {
+	return i->op != TM_NONE && i->op != TM_HALT && i->op != TM_OUT && i->op != TM_ST &&
+	       i->op < TM_JLT && i->r == reg;
+}
+
+/* next is the first instruction from loc on, or size */
+static int next(int loc) {
+	while (loc < size && program[loc].op == TM_NONE) loc++;
+	return loc;
+}
+
+static int following(const int loc) {
+	return next(loc + 1);
+}
+
+static int previous(int loc) {
+	do loc--;
+	while (loc >= 0 && program[loc].op == TM_NONE);
+	return loc;
+}
+
+/* target is the location a jump or a return address
+ * leads to, -1 for other instructions */
+static int target(const int loc) {
+	const Instruction* i = &program[loc];
+	int                to;
+	if (i->flags & CODE_ADDRESS)
+		to = i->d;
+	else if (isJump(i))
+		to = loc + 1 + i->d;
+	else
+		return -1;
+	return to < 0 ? -1 : to > size ? size : to;
+}
+
+/* destination is the instruction target leads to */
+static int destination(const int loc) {
+	const int to = target(loc);
+	return to < 0 ? -1 : next(to);
+}
+
+static void addLabel(const int loc) {
+	const int to = destination(loc);
+	if (to >= 0) labels[to]++;
+}
+
+static void removeLabel(const int loc) {
+	const int to = destination(loc);
+	if (to >= 0) labels[to]--;
+}
+
+/* rewrite changes the instruction at loc, which keeps
+ * its comment */
+static void rewrite(const int loc, const TMOpcode op, const int r, const int d, const int s) {
+	removeLabel(loc);
+	program[loc].op    = op;
+	program[loc].r     = r;
+	program[loc].d     = d;
+	program[loc].s     = s;
+	program[loc].flags = 0;
+	addLabel(loc);
+}
+
+/* drop removes the instruction at loc; what led there
+ * leads to the next instruction instead */
+static void drop(const int loc) {
+	removeLabel(loc);
+	program[loc].op = TM_NONE;
+	labels[next(loc)] += labels[loc];
+	labels[loc] = 0;
+	dropped++;
+}
+
+/* isDead is TRUE when every path from loc on sets reg
+ * before it uses it */
+static bool isDead(const int reg, const int from) {
+	int pending[DEAD_PATHS];
+	int count = 0;
+	int steps = 0;
+	pending[count++] = from;
+	while (count > 0) {
+		int loc = next(pending[--count]);
+		for (;;) {
+			if (loc >= size || ++steps > DEAD_STEPS) return FALSE;
+			const Instruction* i = &program[loc];
+			if (reads(i, reg)) return FALSE;
+			if (writes(i, reg) || i->op == TM_HALT) break;
+			if (isJump(i)) {
+				const int to = destination(loc);
+				if (to < 0) return FALSE;
+				if (isGoto(i)) {
+					loc = to;
+					continue;
+				}
+				if (count == DEAD_PATHS) return FALSE;
+				pending[count++] = to;
+			} else if (writesPC(i)) {
+				/* a return to the caller */
+				if (i->op == TM_LD && (reg == AC1 || reg == R3 || reg == R4)) break;
+				return FALSE;
+			}
+			loc = following(loc);
+		}
+	}
+	return TRUE;
+}
+
+/* the rules, each applied at the instruction at loc */
+
+/* a jump to the next instruction */
+static bool jumpToNext(const int loc) {
+	if (!isJump(&program[loc]) || destination(loc) != following(loc)) return FALSE;
+	drop(loc);
+	return TRUE;
+}
+
+/* a jump to an unconditional jump goes where that one
+ * goes */
+static bool jumpToJump(const int loc) {
+	if (!isJump(&program[loc])) return FALSE;
+	const int to = destination(loc);
+	if (to < 0 || to >= size || to == loc || !isGoto(&program[to])) return FALSE;
+	const int end = target(to);
+	if (end < 0 || next(end) == to) return FALSE;
+	rewrite(loc, program[loc].op, program[loc].r, end - (loc + 1), PC);
+	return TRUE;
+}
+
+/* no instruction after one that does not fall through
+ * runs, up to the next one a jump leads to */
+static bool unreachable(const int loc) {
+	if (!ends(&program[loc])) return FALSE;
+	bool deleted = FALSE;
+	for (int at = following(loc); at < size && labels[at] == 0; at = following(at)) {
+		drop(at);
+		deleted = TRUE;
+	}
+	return deleted;
+}
+
+static TMOpcode negate(const TMOpcode op) {
+	switch (op) {
+		case TM_JLT:
+			return TM_JGE;
+		case TM_JLE:
+			return TM_JGT;
+		case TM_JGT:
+			return TM_JLE;
+		case TM_JGE:
+			return TM_JLT;
+		case TM_JEQ:
+			return TM_JNE;
+		default:
+			return TM_JEQ;
+	}
+}
+
+/* a comparison sets AC to 0 or 1 with
+ *     Jcc AC,2(PC); LDC AC,0; LDA PC,1(PC); LDC AC,1
+ * for an if or a while to branch on with JEQ AC: when
+ * AC is dead after the branch that branches on Jcc */
+static bool branchOnComparison(const int loc) {
+	const Instruction* compare = &program[loc];
+	if (compare->op < TM_JLT || compare->r != AC || compare->s != PC || compare->d != 2)
+		return FALSE;
+	const int isFalse = following(loc);
+	const int skip    = following(isFalse);
+	const int isTrue  = following(skip);
+	const int branch  = following(isTrue);
+	if (branch >= size) return FALSE;
+	const Instruction* b = &program[branch];
+	if (program[isFalse].op != TM_LDC || program[isFalse].r != AC || program[isFalse].d != 0 ||
+	    !isGoto(&program[skip]) || program[isTrue].op != TM_LDC || program[isTrue].r != AC ||
+	    program[isTrue].d != 1 || (b->op != TM_JEQ && b->op != TM_JNE) || b->r != AC ||
+	    b->s != PC)
+		return FALSE;
+	if (destination(loc) != isTrue || destination(skip) != branch || labels[isFalse] ||
+	    labels[skip] || labels[isTrue] != 1 || labels[branch] != 1)
+		return FALSE;
+	if (destination(branch) < 0 || !isDead(AC, following(branch)) ||
+	    !isDead(AC, destination(branch)))
+		return FALSE;
+
+	const TMOpcode op = b->op == TM_JEQ ? negate(compare->op) : compare->op;
+	program[loc].comment = b->comment;
+	rewrite(loc, op, AC, target(branch) - (loc + 1), PC);
+	drop(isFalse);
+	drop(skip);
+	drop(isTrue);
+	drop(branch);
+	return TRUE;
+}
+
+/* LDC x,k when x is known to be k already */
+static bool reloadedConstant(const int loc) {
+	const Instruction* i = &program[loc];
+	if (i->op != TM_LDC || i->r == PC || i->flags || labels[loc]) return FALSE;
+	int at = previous(loc);
+	for (int n = 0; n < WINDOW && at >= 0; n++, at = previous(at)) {
+		const Instruction* p = &program[at];
+		if (writes(p, i->r)) {
+			if (p->op != TM_LDC || p->d != i->d || p->flags) return FALSE;
+			drop(loc);
+			return TRUE;
+		}
+		if (labels[at] || ends(p)) return FALSE;
+	}
+	return FALSE;
+}
+
+static bool touchesSlot(const Instruction* i, const int offset) {
+	if (i->op != TM_LD && i->op != TM_ST) return FALSE;
+	/* globals are far below the frames */
+	return i->s != GP && (i->s != FP || i->d == offset);
+}
+
+/* a temporary pushed from AC and loaded back into a
+ * register stays in that register when nothing in
+ * between needs it */
+static bool temporaryInRegister(const int loc) {
+	static const char* const kept[] = {[AC1] = "keep temporary in AC1",
+	                                   [R3]  = "keep temporary in R3",
+	                                   [R4]  = "keep temporary in R4"};
+
+	const Instruction* push = &program[loc];
+	if (push->op != TM_ST || !(push->flags & CODE_TEMPORARY) || push->r != AC || push->s != FP)
+		return FALSE;
+	int at = following(loc);
+	int n  = 0;
+	for (; n < WINDOW && at < size; n++, at = following(at)) {
+		const Instruction* i = &program[at];
+		if (labels[at]) return FALSE;
+		if (i->op == TM_LD && (i->flags & CODE_TEMPORARY) && i->s == FP && i->d == push->d) break;
+		if (writes(i, FP) || writesPC(i) || i->op == TM_HALT || touchesSlot(i, push->d))
+			return FALSE;
+	}
+	if (n == WINDOW || at >= size) return FALSE;
+
+	const int reg = program[at].r;
+	if (reg > R4 || !kept[reg]) return FALSE;
+	for (int i = following(loc); i < at; i = following(i))
+		if (reads(&program[i], reg) || writes(&program[i], reg)) return FALSE;
+	program[loc].comment = kept[reg];
+	rewrite(loc, TM_LDA, reg, 0, AC);
+	drop(at);
+	return TRUE;
+}
+
+/* LDC x,k; ADD y,y,x is LDA y,k(y) when x is dead */
+static bool constantOperand(const int loc) {
+	const Instruction* c = &program[loc];
+	if (c->op != TM_LDC || c->r == PC || c->flags) return FALSE;
+	const int at = following(loc);
+	if (at >= size || labels[at]) return FALSE;
+	const Instruction* i = &program[at];
+	const int          x = c->r;
+	int                d;
+	if (i->r == x || i->r == PC)
+		return FALSE;
+	else if (i->op == TM_ADD && i->d == i->r && i->s == x)
+		d = c->d;
+	else if (i->op == TM_ADD && i->d == x && i->s == i->r)
+		d = c->d;
+	else if (i->op == TM_SUB && i->d == i->r && i->s == x)
+		d = -c->d;
+	else
+		return FALSE;
+	if (!isDead(x, following(at))) return FALSE;
+	rewrite(at, TM_LDA, i->r, d, i->r);
+	drop(loc);
+	return TRUE;
+}
+
+/* LDC x,k; LDA x,j(x) is LDC x,k+j */
+static bool constantOffset(const int loc) {
+	const Instruction* c = &program[loc];
+	if (c->op != TM_LDC || c->r == PC || c->flags) return FALSE;
+	const int at = following(loc);
+	if (at >= size || labels[at]) return FALSE;
+	const Instruction* i = &program[at];
+	if (i->op != TM_LDA || i->r != c->r || i->s != c->r) return FALSE;
+	rewrite(loc, TM_LDC, c->r, c->d + i->d, 0);
+	drop(at);
+	return TRUE;
+}
+
+/* LDA x,k(y); LD z,j(x) is LD z,k+j(y) when x is dead
+ * after, or z is x, and so for ST */
+static bool addressOffset(const int loc) {
+	const Instruction* a = &program[loc];
+	if (a->op != TM_LDA || a->r == PC || a->s == PC) return FALSE;
+	const int at = following(loc);
+	if (at >= size || labels[at]) return FALSE;
+	const Instruction* i = &program[at];
+	const int          x = a->r;
+	if ((i->op != TM_LD && i->op != TM_ST) || i->s != x || i->r == PC) return FALSE;
+	if (!(i->op == TM_LD && i->r == x) && (i->r == x || !isDead(x, following(at))))
+		return FALSE;
+	rewrite(at, i->op, i->r, a->d + i->d, a->s);
+	drop(loc);
+	return TRUE;
+}
+
+/* ST r,d(s); LD r,d(s) loads what is in r already */
+static bool loadAfterStore(const int loc) {
+	const Instruction* st = &program[loc];
+	if (st->op != TM_ST) return FALSE;
+	const int at = following(loc);
+	if (at >= size || labels[at]) return FALSE;
+	const Instruction* i = &program[at];
+	if (i->op != TM_LD || i->r != st->r || i->d != st->d || i->s != st->s || i->r == PC)
+		return FALSE;
+	drop(at);
+	return TRUE;
+}
+
+typedef struct Rule {
+	const char* name;
+	bool (*apply)(int loc);
+} Rule;
+
+static const Rule rules[] = {
+    {"jump to the next instruction", jumpToNext},
+    {"jump to a jump", jumpToJump},
+    {"unreachable code", unreachable},
+    {"branch on a comparison", branchOnComparison},
+    {"reloaded constant", reloadedConstant},
+    {"temporary kept in a register", temporaryInRegister},
+    {"constant operand", constantOperand},
+    {"constant offset", constantOffset},
+    {"address offset", addressOffset},
+    {"load of a stored value", loadAfterStore},
+};
+
+#define RULE_COUNT ((int) (sizeof(rules) / sizeof(rules[0])))
+
+int optimizeCode(void) {
+	program = codeBuffer(&size);
+	labels  = calloc(size + 1, sizeof(int));
+	dropped = 0;
+	if (!labels) {
+		fprintf(stderr, "Out of memory: cannot optimize %d instructions\n", size);
+		exit(1);
+	}
+	int before = 0;
+	for (int loc = 0; loc < size; loc++)
+		if (program[loc].op != TM_NONE) {
+			before++;
+			addLabel(loc);
+		}
+
+	int  applied[RULE_COUNT] = {0};
+	int  saved[RULE_COUNT]   = {0};
+	bool changed             = TRUE;
+	for (int sweep = 0; changed && sweep < MAX_SWEEPS; sweep++) {
+		changed = FALSE;
+		for (int loc = next(0); loc < size; loc = following(loc))
+			for (int k = 0; k < RULE_COUNT && program[loc].op != TM_NONE; k++) {
+				const int was = dropped;
+				if (rules[k].apply(loc)) {
+					applied[k]++;
+					saved[k] += dropped - was;
+					changed = TRUE;
+				}
+			}
+	}
+
+	/* move the code together */
+	int* newLoc = labels;
+	int  after  = 0;
+	for (int loc = 0; loc <= size; loc++) {
+		newLoc[loc] = after;
+		if (loc < size && program[loc].op != TM_NONE) after++;
+	}
+	for (int loc = 0; loc < size; loc++) {
+		const int to = target(loc);
+		if (program[loc].op == TM_NONE || to < 0) continue;
+		if (program[loc].flags & CODE_ADDRESS)
+			program[loc].d = newLoc[to];
+		else
+			program[loc].d = newLoc[to] - (newLoc[loc] + 1);
+	}
+	moveCode(newLoc, size);
+	free(labels);
+
+	if (TraceCode) {
+		emitComment(formatString("Peephole optimization saved %d of %d instructions:",
+		                         before - after, before));
+		for (int k = 0; k < RULE_COUNT; k++)
+			if (applied[k])
+				emitComment(formatString("  %s: %d applied, %d saved", rules[k].name, applied[k],
+				                         saved[k]));
+	}
+	return before - after;
+}
@@ -0,0 +1,25 @@
+#ifndef _PEEPHOLE_H_
+#define _PEEPHOLE_H_
+
+/* The peephole optimizer rewrites the instruction
+ * buffer (code.h) of a whole program before it is
+ * written. A table of rules slides over the code, each
+ * matching a short window of instructions, until none
+ * applies; then the code left is moved together, and
+ * jumps and return addresses are relocated.
+ *
+ * It relies on what cgen.c generates: code locations
+ * are only taken by pc-relative jumps and by return
+ * addresses (emitRM_Loc), the only other jump is the
+ * return to a caller, which passes nothing back in
+ * AC1, R3 and R4, and expression temporaries
+ * (emitRM_Temp) are dead once they are loaded back.
+ */
+
+/* Function optimizeCode runs the peephole optimizer
+ * over the code emitted so far and returns the number
+ * of instructions it saved
+ */
+int optimizeCode(void);
+
+#endif
@@ -3,15 +3,39 @@
 
 #include "globals.h"
 
-/* MAXTOKENLEN is the maximum size of a token */
-#define MAXTOKENLEN 40
+union YYSTYPE; /* semantic value of a token, see parser.h */
 
-/* tokenString array stores the lexeme of each token */
-extern char tokenString[MAXTOKENLEN + 1];
+/* A ScanContext holds all state of one scan of a
+ * source text. Nothing is kept in globals, so any
+ * number of scans can run side by side
+ */
+typedef struct ScanContext {
+	const SourceText* source;
+	void*             scanner;     /* yyscan_t of the flex scanner */
+	int               lineno;      /* source line number for listing */
+	TokenType         token;       /* kind of the last token */
+	TokenSpan         tokenSpan;   /* lexeme of the last token; lexemes are never copied */
+	size_t            position;    /* offset of the next byte to scan */
+	size_t            buffered;    /* bytes of source handed to the flex scanner */
+	size_t            echoedLines; /* source lines printed by printLine */
+	int               quiet;       /* TRUE to neither echo lines nor trace tokens */
+	int               deferNames;  /* TRUE to leave the names of IDs NULL, not interned */
+} ScanContext;
+
+/* Procedure initScanner prepares context for
+ * scanning source with the selected scanner
+ */
+void initScanner(ScanContext* context, const SourceText* source);
+
+/* Procedure closeScanner frees the scanner state
+ * of context
+ */
+void closeScanner(ScanContext* context);
 
 /* function getToken returns the
- * next token in source file
+ * next token in source file and stores
+ * its semantic value in value
  */
-TokenType getToken(void);
+TokenType getToken(ScanContext* context, union YYSTYPE* value);
 
 #endif
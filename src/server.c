@@ -0,0 +1,320 @@
+#include "server.h"
+#include "util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* largest source text a request may carry */
+#define MAX_REQUEST_TEXT (64L << 20)
+
+/* Wire protocol, one request per connection.
+ *
+ * The client sends header lines "<key> <value>\n" ended by an
+ * empty line:
+ *   cwd <dir>       directory the request paths are relative to
+ *   file <name>     source file name (names the outputs too)
+ *   detail <dir>    detail output directory (omit for none)
+ *   option <word>   the next word of the client's options
+ *   text <length>   <length> bytes of source follow the header
+ *
+ * No value may hold a newline, and each key but option appears
+ * at most once; the server rejects any other header.
+ *
+ * The server answers with a line "<length> <status>\n" and then
+ * <length> bytes: exactly what a local run would print on stdout
+ * and stderr. The output may hold any byte, since it echoes the
+ * source.
+ */
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int signo) {
+	(void) signo;
+	stopRequested = 1;
+}
+
+/* readAll reads fd until end of file into a malloc'd,
+ * NUL-terminated buffer
+ */
+static char* readAll(const int fd, size_t* length) {
+	size_t capacity = 4096;
+	char*  buffer   = malloc(capacity);
+	*length         = 0;
+	while (buffer) {
+		if (*length + 1 == capacity) {
+			char* grown = realloc(buffer, capacity *= 2);
+			if (!grown) break;
+			buffer = grown;
+		}
+		const ssize_t n = read(fd, buffer + *length, capacity - *length - 1);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			buffer[*length] = '\0';
+			return buffer;
+		}
+		*length += n;
+	}
+	free(buffer);
+	return NULL;
+}
+
+static int fillAddress(struct sockaddr_un* address, const char* socketPath) {
+	if (strlen(socketPath) >= sizeof(address->sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", socketPath);
+		return 0;
+	}
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	strcpy(address->sun_path, socketPath);
+	return 1;
+}
+
+/* writeAll writes length bytes to fd */
+static int writeAll(const int fd, const char* bytes, size_t length) {
+	while (length > 0) {
+		const ssize_t n = write(fd, bytes, length);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		bytes += n;
+		length -= n;
+	}
+	return 1;
+}
+
+/* sendOutput sends the client the output captured in
+ * the file capture, after its length and the status
+ */
+static void sendOutput(const int connection, const int capture, const int status) {
+	const off_t printed = lseek(capture, 0, SEEK_END);
+	if (printed < 0 || lseek(capture, 0, SEEK_SET) != 0) return;
+
+	char      header[64];
+	const int headerLength =
+	    snprintf(header, sizeof(header), "%lld %d\n", (long long) printed, status);
+	if (!writeAll(connection, header, headerLength)) return;
+
+	char    buffer[65536];
+	ssize_t n;
+	while ((n = read(capture, buffer, sizeof(buffer))) > 0)
+		if (!writeAll(connection, buffer, n)) return;
+}
+
+/* serveRequest runs in the forked child: it reads the
+ * request header, compiles with stdout and stderr going
+ * to a temporary file, and sends the client what was
+ * printed there, framed by its length
+ */
+static int serveRequest(const int connection, CompileFn compile) {
+	FILE*   in          = fdopen(connection, "r");
+	char*   cwd         = NULL;
+	char*   fileName    = NULL;
+	char*   detailPath  = NULL;
+	char*   text        = NULL;
+	long    textLength  = -1;
+	char**  options     = NULL;
+	int     optionCount = 0;
+	char*   line        = NULL;
+	size_t  capacity    = 0;
+	ssize_t length;
+	int     malformed   = !in;
+
+	while (!malformed && (length = getline(&line, &capacity, in)) > 0) {
+		if (line[length - 1] == '\n') line[--length] = '\0';
+		if (length == 0) break;
+
+		/* a repeated or unknown key is a value that smuggled in a newline */
+		char* value = strchr(line, ' ');
+		if (!value) {
+			malformed = 1;
+			break;
+		}
+		*value++ = '\0';
+		if (strcmp(line, "cwd") == 0 && !cwd)
+			cwd = strdup(value);
+		else if (strcmp(line, "file") == 0 && !fileName)
+			fileName = strdup(value);
+		else if (strcmp(line, "detail") == 0 && !detailPath)
+			detailPath = strdup(value);
+		else if (strcmp(line, "text") == 0 && textLength < 0) {
+			if (!parseNumber(value, 0, MAX_REQUEST_TEXT, &textLength)) malformed = 1;
+		} else if (strcmp(line, "option") == 0) {
+			char** grown = realloc(options, (optionCount + 1) * sizeof(char*));
+			if (!grown) break;
+			options                = grown;
+			options[optionCount++] = strdup(value);
+		} else
+			malformed = 1;
+	}
+	free(line);
+
+	malformed = malformed || !fileName || (cwd && chdir(cwd) != 0);
+	if (!malformed && textLength >= 0) {
+		text = malloc(textLength + 1);
+		if (!text || fread(text, 1, textLength, in) != (size_t) textLength) malformed = 1;
+	}
+
+	FILE* output = tmpfile();
+	if (!output) {
+		perror("tmpfile");
+		return 1;
+	}
+	const int capture = fileno(output);
+	dup2(capture, STDOUT_FILENO);
+	dup2(capture, STDERR_FILENO);
+
+	int status = 1;
+	if (malformed) {
+		fprintf(stderr, "Malformed compile request\n");
+	} else {
+		const CompileRequest request = {fileName,
+		                                detailPath,
+		                                text,
+		                                textLength >= 0 ? (size_t) textLength : 0,
+		                                options,
+		                                optionCount};
+		status = compile(&request);
+	}
+	fflush(stdout);
+	fflush(stderr);
+
+	sendOutput(connection, capture, status);
+	return status;
+}
+
+int serveCompiler(const char* socketPath, CompileFn compile) {
+	struct sockaddr_un address;
+	if (!fillAddress(&address, socketPath)) return 1;
+
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		perror("socket");
+		return 1;
+	}
+	unlink(socketPath);
+	if (bind(listener, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+	    listen(listener, SOMAXCONN) < 0) {
+		perror(socketPath);
+		close(listener);
+		return 1;
+	}
+
+	/* no SA_RESTART, so a signal interrupts accept */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestStop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGCHLD, SIG_IGN); /* children are reaped automatically */
+
+	fprintf(stderr, "Compile server listening on %s\n", socketPath);
+	while (!stopRequested) {
+		const int connection = accept(listener, NULL, NULL);
+		if (connection < 0) {
+			if (errno == EINTR) continue;
+			perror("accept");
+			break;
+		}
+
+		fflush(NULL);
+		const pid_t child = fork();
+		if (child == 0) {
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			signal(SIGCHLD, SIG_DFL);
+			close(listener);
+			_exit(serveRequest(connection, compile));
+		}
+		if (child < 0) perror("fork");
+		close(connection);
+	}
+
+	close(listener);
+	unlink(socketPath);
+	return 0;
+}
+
+int runClient(const char* socketPath, char* options[], const int optionCount, const char* fileName,
+              const char* detailPath) {
+	struct sockaddr_un address;
+	if (!fillAddress(&address, socketPath)) return 1;
+
+	char*  text       = NULL;
+	size_t textLength = 0;
+	if (strcmp(fileName, "-") == 0) {
+		text = readAll(STDIN_FILENO, &textLength);
+		if (!text) {
+			fprintf(stderr, "Unable to read source from stdin\n");
+			return 1;
+		}
+		fileName = "stdin.cm";
+	}
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		perror("getcwd");
+		return 1;
+	}
+
+	/* a newline would end its header line early */
+	const char* values[] = {cwd, fileName, detailPath};
+	for (int i = 0; i < optionCount + 3; i++) {
+		const char* value = i < 3 ? values[i] : options[i - 3];
+		if (strchr(value, '\n')) {
+			fprintf(stderr, "Cannot send a value with a newline: %s\n", value);
+			free(text);
+			return 1;
+		}
+	}
+	if (textLength > MAX_REQUEST_TEXT) {
+		fprintf(stderr, "Source is too long to send\n");
+		free(text);
+		return 1;
+	}
+
+	const int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0 || connect(connection, (struct sockaddr*) &address, sizeof(address)) < 0) {
+		perror(socketPath);
+		return 1;
+	}
+
+	FILE* out = fdopen(dup(connection), "w");
+	if (!out) {
+		perror("fdopen");
+		return 1;
+	}
+	fprintf(out, "cwd %s\nfile %s\n", cwd, fileName);
+	if (strcmp(detailPath, "-") != 0) fprintf(out, "detail %s\n", detailPath);
+	for (int i = 0; i < optionCount; i++) fprintf(out, "option %s\n", options[i]);
+	if (text) fprintf(out, "text %zu\n", textLength);
+	fputc('\n', out);
+	if (text) fwrite(text, 1, textLength, out);
+	fclose(out);
+	shutdown(connection, SHUT_WR);
+	free(text);
+
+	size_t responseLength;
+	char*  response = readAll(connection, &responseLength);
+	close(connection);
+
+	/* the output follows a "<length> <status>" line */
+	const char* body    = response ? memchr(response, '\n', responseLength) : NULL;
+	long long   printed = -1;
+	int         status  = 1;
+	if (body && sscanf(response, "%lld %d", &printed, &status) == 2) body++;
+	if (!body || printed < 0 || (size_t) printed != responseLength - (body - response)) {
+		fprintf(stderr, "Compile server closed the connection\n");
+		free(response);
+		return 1;
+	}
+	fwrite(body, 1, printed, stdout);
+	free(response);
+	return status;
+}
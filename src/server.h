@@ -0,0 +1,40 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stddef.h>
+
+/* CompileRequest describes one compilation, either
+ * of a file on disk or of in-memory source text
+ */
+typedef struct CompileRequest {
+	const char* fileName;   /* source file name, also names the detail outputs */
+	const char* detailPath; /* directory for detail outputs, NULL for none */
+	const char* text;       /* in-memory source text, NULL to read fileName */
+	size_t      textLength;
+	char**      options;    /* command line options of the client, applied first */
+	int         optionCount;
+} CompileRequest;
+
+/* CompileFn runs one compilation and returns
+ * the process exit status it would have produced
+ */
+typedef int (*CompileFn)(const CompileRequest* request);
+
+/* Function serveCompiler listens on the Unix domain
+ * socket socketPath and answers compile requests,
+ * forking a child of the warm process for each one.
+ * It returns when interrupted by SIGINT or SIGTERM
+ */
+int serveCompiler(const char* socketPath, CompileFn compile);
+
+/* Function runClient sends fileName ("-" reads the
+ * source from stdin) and the options to compile it
+ * with to the server at socketPath, copies the compiler
+ * output to stdout and returns the exit status of the
+ * remote compilation. detailPath "-" asks for no detail
+ * outputs
+ */
+int runClient(const char* socketPath, char* options[], int optionCount, const char* fileName,
+              const char* detailPath);
+
+#endif
@@ -0,0 +1,131 @@
+#include "source.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* indexLines records where every line starts. memchr
+ * finds the newlines a vector at a time
+ */
+static void indexLines(SourceText* source) {
+	const char* text     = source->text;
+	const char* end      = text + source->length;
+	size_t      capacity = 64;
+	size_t      count    = 0;
+	size_t*     starts   = malloc(capacity * sizeof(size_t));
+
+	for (const char* line = text; starts && line < end;) {
+		if (count == capacity) {
+			starts = realloc(starts, (capacity *= 2) * sizeof(size_t));
+			if (!starts) break; /* fatal below, the leak does not matter */
+		}
+		starts[count++]     = line - text;
+		const char* newline = memchr(line, '\n', end - line);
+		line                = newline ? newline + 1 : end;
+	}
+	if (!starts) {
+		fprintf(stderr, "Out of memory: cannot index the lines of the source\n");
+		exit(1);
+	}
+	source->lineStarts = starts;
+	source->lineCount  = count;
+}
+
+/* readSource is the fallback for files that cannot be
+ * mapped, such as pipes
+ */
+static int readSource(SourceText* source, const int fd) {
+	size_t capacity = 4096;
+	char*  text     = malloc(capacity);
+	size_t length   = 0;
+	while (text) {
+		if (length + SOURCE_PADDING >= capacity) {
+			char* grown = realloc(text, capacity *= 2);
+			if (!grown) break;
+			text = grown;
+		}
+		const ssize_t n = read(fd, text + length, capacity - length - SOURCE_PADDING);
+		if (n < 0) break;
+		if (n == 0) {
+			memset(text + length, 0, SOURCE_PADDING);
+			source->text         = text;
+			source->length       = length;
+			source->mappedLength = 0;
+			indexLines(source);
+			return 1;
+		}
+		length += n;
+	}
+	free(text);
+	return 0;
+}
+
+int openSource(SourceText* source, const char* path) {
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+
+	struct stat info;
+	if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+		const int ok = readSource(source, fd);
+		close(fd);
+		return ok;
+	}
+
+	/* Reserve zeroed pages for the text plus its padding, then
+	 * map the file over the front of them. The mapping is
+	 * private, so writes to the text never reach the file
+	 */
+	const size_t length = info.st_size;
+	const size_t page   = sysconf(_SC_PAGESIZE);
+	const size_t mapped = (length + SOURCE_PADDING + page - 1) / page * page;
+	char*        text =
+	    mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	int ok = text != MAP_FAILED;
+	if (ok && length > 0 &&
+	    mmap(text, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(text, mapped);
+		ok = 0;
+	}
+	close(fd);
+	if (!ok) return 0;
+
+	source->text         = text;
+	source->length       = length;
+	source->mappedLength = mapped;
+	indexLines(source);
+	return 1;
+}
+
+void sourceFromMemory(SourceText* source, const char* text, const size_t length) {
+	source->text = malloc(length + SOURCE_PADDING);
+	if (!source->text) {
+		fprintf(stderr, "Out of memory: cannot copy %zu bytes of source\n", length);
+		exit(1);
+	}
+	memcpy(source->text, text, length);
+	memset(source->text + length, 0, SOURCE_PADDING);
+	source->length       = length;
+	source->mappedLength = 0;
+	indexLines(source);
+}
+
+void closeSource(SourceText* source) {
+	if (source->mappedLength)
+		munmap(source->text, source->mappedLength);
+	else
+		free(source->text);
+	free(source->lineStarts);
+	memset(source, 0, sizeof(*source));
+}
+
+const char* sourceLine(const SourceText* source, const size_t line, size_t* length) {
+	const size_t start = source->lineStarts[line];
+	const size_t end =
+	    line + 1 < source->lineCount ? source->lineStarts[line + 1] : source->length;
+	*length = end - start;
+	return source->text + start;
+}
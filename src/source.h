@@ -0,0 +1,54 @@
+#ifndef _SOURCE_H_
+#define _SOURCE_H_
+
+#include <stddef.h>
+
+/* SOURCE_PADDING NUL bytes follow the text, so that it
+ * is always NUL-terminated */
+#define SOURCE_PADDING 2
+
+/* A SourceText is the whole source program in memory.
+ * Files are mapped copy-on-write rather than read, and
+ * tokens are (offset, length) spans into it, never
+ * copies of their lexemes. The start of
+ * every line is indexed once, when the text is loaded
+ */
+typedef struct SourceText {
+	char*   text;         /* length bytes followed by SOURCE_PADDING NULs */
+	size_t  length;
+	size_t  mappedLength; /* 0 when text was malloc'd instead */
+	size_t* lineStarts;   /* offset of the first byte of each line */
+	size_t  lineCount;    /* a final newline does not start a line */
+} SourceText;
+
+/* TokenSpan locates a lexeme in the source text */
+typedef struct TokenSpan {
+	size_t offset;
+	size_t length;
+} TokenSpan;
+
+/* Function openSource maps the file at path into
+ * source. It returns 0 if the file cannot be read
+ */
+int openSource(SourceText* source, const char* path);
+
+/* Procedure sourceFromMemory copies length bytes of
+ * text into source
+ */
+void sourceFromMemory(SourceText* source, const char* text, size_t length);
+
+/* Procedure closeSource unmaps or frees the text */
+void closeSource(SourceText* source);
+
+/* Function sourceLine returns the text of line
+ * (counted from 0) and stores its length, including
+ * the newline, in length
+ */
+const char* sourceLine(const SourceText* source, size_t line, size_t* length);
+
+/* Function spanText returns the first byte of span */
+static inline const char* spanText(const SourceText* source, const TokenSpan span) {
+	return source->text + span.offset;
+}
+
+#endif
@@ -1,93 +1,198 @@
 #include "symtab.h"
+#include "arena.h"
+#include "intern.h"
 #include "util.h"
 #include <log.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define HASH_SIZE 211
-#define SHIFT 4
 #define REF_CAPACITY 10
 
-static unsigned int hash(const char* name) {
-	unsigned int h = 0;
-	while (*name) {
-		h = h * 31 + *name++;
-	}
-	return h % HASH_SIZE;
-}
+/* the listing prints symbols in the order of the
+ * chained table of 211 buckets that scopes used to
+ * have: by bucket, the latest insertion first */
+#define PRINT_BUCKETS 211
+
+/* tables grow when more than 3/4 of the slots are used */
+#define MAX_LOAD(capacity) ((capacity) / 4 * 3)
+#define INITIAL_NAME_SLOTS 64
+
+/* the binding stacks of findSymbol, one per name; every
+ * thread has its own */
+typedef struct NameSlot {
+	const char*  name; // NULL for an empty slot
+	unsigned int hash;
+	Binding*     top;
+} NameSlot;
+
+static _Thread_local NameSlot* nameSlots     = NULL;
+static _Thread_local int       nameCapacity  = 0;
+static _Thread_local int       nameCount     = 0;
+static _Thread_local Scope*    innermostOpen = NULL; // the scope findSymbol was last asked about
+static _Thread_local Binding*  freeBindings  = NULL;
+static _Thread_local Scope*    sharedScope   = NULL; // read, never opened (see shareScope)
 
 Symbol* createSymbol(const char* name, const SymbolKind kind, TypeInfo* type, int offset) {
-	Symbol* symbol = malloc(sizeof(Symbol));
-	if (!symbol) return NULL;
+	Symbol* symbol = ARENA_NEW(threadArena, Symbol);
 
-	symbol->name   = strdup(name);
+	symbol->name   = name;
 	symbol->kind   = kind;
 	symbol->type   = type;
 	symbol->offset = offset;
-	symbol->next   = NULL;
+	symbol->order  = 0;
 
-	if (symbol->kind == SYMBOL_FUNCTION) symbol->type->returnType = createType(type->baseType);
+	/* types are shared, so a function gets its own type
+	 * with the return type filled in */
+	if (symbol->kind == SYMBOL_FUNCTION)
+		symbol->type = internType(type->baseType, type->arraySize, createType(type->baseType),
+		                          type->parameters.types, type->parameters.count);
 
 	symbol->sourceInfo.definedAt  = 0;
-	symbol->sourceInfo.references = (int*) malloc(REF_CAPACITY * sizeof(int));
+	symbol->sourceInfo.references = NULL;
 	symbol->sourceInfo.refCount   = 0;
 
 	return symbol;
 }
 
+/* findSlot returns the slot holding name, or the
+ * empty slot where it would go. Probing is linear, and
+ * the stored hash spares most symbol dereferences
+ */
+static SymbolSlot* findSlot(const Scope* scope, const char* name, const unsigned int h) {
+	const unsigned int mask = scope->capacity - 1;
+	for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+		SymbolSlot* slot = &scope->symbols[i];
+		if (!slot->symbol || (slot->hash == h && slot->symbol->name == name)) return slot;
+	}
+}
+
+static void growScope(Scope* scope) {
+	const SymbolSlot* old         = scope->symbols;
+	const int         oldCapacity = scope->capacity;
+
+	scope->capacity = oldCapacity * 2;
+	scope->symbols  = ARENA_NEW_ARRAY(threadArena, SymbolSlot, scope->capacity);
+	for (int i = 0; i < oldCapacity; i++)
+		if (old[i].symbol) *findSlot(scope, old[i].symbol->name, old[i].hash) = old[i];
+}
+
+static NameSlot* findNameSlot(const char* name, const unsigned int h) {
+	const unsigned int mask = nameCapacity - 1;
+	for (unsigned int i = h & mask;; i = (i + 1) & mask) {
+		NameSlot* slot = &nameSlots[i];
+		if (!slot->name || slot->name == name) return slot;
+	}
+}
+
+/* nameStack returns the slot holding the binding stack of name */
+static NameSlot* nameStack(const char* name) {
+	if (nameCount + 1 > MAX_LOAD(nameCapacity)) {
+		const NameSlot* old         = nameSlots;
+		const int       oldCapacity = nameCapacity;
+
+		nameCapacity = oldCapacity ? oldCapacity * 2 : INITIAL_NAME_SLOTS;
+		nameSlots    = ARENA_NEW_ARRAY(threadArena, NameSlot, nameCapacity);
+		for (int i = 0; i < oldCapacity; i++)
+			if (old[i].name) *findNameSlot(old[i].name, old[i].hash) = old[i];
+	}
+
+	const unsigned int h    = nameHash(name);
+	NameSlot*          slot = findNameSlot(name, h);
+	if (!slot->name) {
+		slot->name = name;
+		slot->hash = h;
+		nameCount++;
+	}
+	return slot;
+}
+
+/* bind pushes symbol on the stack of its name, under
+ * the bindings of scopes nested in scope */
+static void bind(Scope* scope, Symbol* symbol) {
+	Binding* binding = freeBindings;
+	if (binding)
+		freeBindings = binding->below;
+	else
+		binding = ARENA_NEW(threadArena, Binding);
+	binding->symbol = symbol;
+	binding->scope  = scope;
+
+	Binding** above = &nameStack(symbol->name)->top;
+	while (*above && (*above)->scope->level > scope->level) above = &(*above)->below;
+	binding->below       = *above;
+	*above               = binding;
+	binding->nextInScope = scope->bindings;
+	scope->bindings      = binding;
+}
+
+static void openScope(Scope* scope) {
+	if (!scope || scope == sharedScope || scope->open) return;
+	openScope(scope->parent);
+
+	for (int i = 0; i < scope->capacity; i++)
+		if (scope->symbols[i].symbol) bind(scope, scope->symbols[i].symbol);
+	scope->open   = true;
+	innermostOpen = scope;
+}
+
+/* closeInnermost pops the bindings of the innermost
+ * open scope, which are on top of their stacks */
+static void closeInnermost(void) {
+	Scope* scope = innermostOpen;
+	while (scope->bindings) {
+		Binding* binding = scope->bindings;
+		scope->bindings  = binding->nextInScope;
+
+		findNameSlot(binding->symbol->name, nameHash(binding->symbol->name))->top = binding->below;
+		binding->below = freeBindings;
+		freeBindings   = binding;
+	}
+	scope->open   = false;
+	innermostOpen = scope->parent != sharedScope ? scope->parent : NULL;
+}
+
+static bool isAncestor(const Scope* ancestor, const Scope* scope) {
+	while (scope && scope->level > ancestor->level) scope = scope->parent;
+	return scope == ancestor;
+}
+
+/* makeInnermost opens scope and its ancestors and
+ * closes every other scope */
+static void makeInnermost(Scope* scope) {
+	while (innermostOpen && !isAncestor(innermostOpen, scope)) closeInnermost();
+	openScope(scope);
+}
+
 void addSymbol(Scope* scope, Symbol* symbol) {
 	if (!scope || !symbol) return;
 
-	const unsigned int h = hash(symbol->name);
-	if (!scope->symbols) scope->symbols = (Symbol**) calloc(HASH_SIZE, sizeof(Symbol*));
+	if (scope->symbolCount + 1 > MAX_LOAD(scope->capacity)) growScope(scope);
 
-	Symbol* current = scope->symbols[h];
-	while (current) {
-		if (strcmp(current->name, symbol->name) == 0) return;
-		current = current->next;
-	}
+	const unsigned int h    = nameHash(symbol->name);
+	SymbolSlot*        slot = findSlot(scope, symbol->name, h);
+	if (slot->symbol) return;
 
-	symbol->next      = scope->symbols[h];
-	scope->symbols[h] = symbol;
-	scope->symbolCount++;
+	symbol->order = scope->symbolCount++;
+	slot->hash    = h;
+	slot->symbol  = symbol;
+	if (scope->open) bind(scope, symbol);
 }
 
 Symbol* findSymbol(Scope* scope, const char* name) {
 	if (!scope || !name) return NULL;
 
-	Symbol*            current = NULL;
-	const unsigned int h       = hash(name);
-	while (scope) {
-		if (scope->symbols) {
-			current = scope->symbols[h];
-			while (current) {
-				if (strcmp(current->name, name) == 0) {
-					return current;
-				}
-				current = current->next;
-			}
-		}
-		scope = scope->parent;
-	}
-	return current;
+	if (scope != innermostOpen) makeInnermost(scope);
+	const Binding* top = nameStack(name)->top;
+	if (top) return top->symbol;
+	return sharedScope && isAncestor(sharedScope, scope) ? findSymbolInScope(sharedScope, name)
+	                                                     : NULL;
 }
 
 Symbol* findSymbolInScope(Scope* scope, const char* name) {
 	if (!scope || !name) return NULL;
 
-	Symbol*            current = NULL;
-	const unsigned int h       = hash(name);
-	if (scope->symbols) {
-		current = scope->symbols[h];
-		while (current) {
-			if (strcmp(current->name, name) == 0) {
-				return current;
-			}
-			current = current->next;
-		}
-	}
-	return current;
+	return findSlot(scope, name, nameHash(name))->symbol;
 }
 
 static bool findReference(Symbol* symbol, const int lineNo) {
@@ -107,59 +212,45 @@ void addReference(Symbol* symbol, const int lineNo) {
 		return;
 	}
 	if (symbol->sourceInfo.refCount % REF_CAPACITY == 0) {
-		const int newSize = (symbol->sourceInfo.refCount + REF_CAPACITY) * sizeof(int);
-		int*      newRefs = realloc(symbol->sourceInfo.references, newSize);
-		if (!newRefs) return;
-		symbol->sourceInfo.references = newRefs;
+		symbol->sourceInfo.references =
+		    ARENA_GROW_ARRAY(threadArena, int, symbol->sourceInfo.references,
+		                     symbol->sourceInfo.refCount,
+		                     symbol->sourceInfo.refCount + REF_CAPACITY);
 	}
 	symbol->sourceInfo.references[symbol->sourceInfo.refCount++] = lineNo;
 }
 
-void destroySymbol(Symbol* symbol) {
-	if (!symbol) return;
-
-	free((void*) symbol->name);
-	free(symbol->sourceInfo.references);
-	free(symbol);
-}
-
 Scope* createScope(const char* name, Scope* parent) {
-	Scope* scope = malloc(sizeof(Scope));
-	if (!scope) return NULL;
+	Scope* scope = ARENA_NEW(threadArena, Scope);
 
-	scope->name        = strdup(name);
+	scope->name        = name;
 	scope->parent      = parent;
 	scope->level       = parent ? parent->level + 1 : 0;
-	scope->symbols     = NULL;
+	scope->symbols     = scope->inlineSymbols;
+	scope->capacity    = SCOPE_INLINE_SLOTS;
 	scope->symbolCount = 0;
 	scope->children    = NULL;
 	scope->childCount  = 0;
+	scope->open        = false;
+	scope->bindings    = NULL;
 
 	return scope;
 }
 
-void destroyScope(Scope* scope) {
-	if (!scope) return;
+void shareScope(Scope* scope) {
+	sharedScope = scope;
+}
 
-	for (int i = 0; i < scope->childCount; i++) {
-		destroyScope(scope->children[i]);
-	}
-	free(scope->children);
-
-	if (scope->symbols) {
-		for (int i = 0; i < HASH_SIZE; i++) {
-			Symbol* current = scope->symbols[i];
-			while (current) {
-				Symbol* next = current->next;
-				destroySymbol(current);
-				current = next;
-			}
-		}
-		free(scope->symbols);
-	}
+void closeScopes(void) {
+	while (innermostOpen) closeInnermost();
+}
 
-	free((void*) scope->name);
-	free(scope);
+void releaseScopes(void) {
+	nameSlots     = NULL;
+	nameCapacity  = 0;
+	nameCount     = 0;
+	innermostOpen = NULL;
+	freeBindings  = NULL;
 }
 
 static const char* getTypeName(const TypeInfo* type) {
@@ -195,7 +286,7 @@ static void printSymbol(Symbol* symbol, const char* scopeName) {
 	if (!symbol) return;
 
 	pc("%-14s ", symbol->name);
-	pc("%-9s ", strcmp(scopeName, "global") == 0 ? "" : scopeName);
+	pc("%-9s ", scopeName == nameGlobal ? "" : scopeName);
 	pc("%-8s ", symbolKindToStr(symbol));
 	pc("%-9s ",
 	   getTypeName(symbol->kind != SYMBOL_FUNCTION ? symbol->type : symbol->type->returnType));
@@ -206,17 +297,28 @@ static void printSymbol(Symbol* symbol, const char* scopeName) {
 	pc("\n");
 }
 
+static int comparePrintOrder(const void* a, const void* b) {
+	const Symbol*      s1 = *(Symbol* const*) a;
+	const Symbol*      s2 = *(Symbol* const*) b;
+	const unsigned int h1 = nameHash(s1->name) % PRINT_BUCKETS;
+	const unsigned int h2 = nameHash(s2->name) % PRINT_BUCKETS;
+	if (h1 != h2) return h1 < h2 ? -1 : 1;
+	return s2->order - s1->order;
+}
+
 static void printScopeSymbols(Scope* scope, int level) {
 	if (!scope) return;
 
-	if (scope->symbols) {
-		for (int i = 0; i < HASH_SIZE; i++) {
-			Symbol* current = scope->symbols[i];
-			while (current) {
-				if (current->kind != SYMBOL_FUNCTION || level == 0) {
-					printSymbol(current, scope->name);
-				}
-				current = current->next;
+	if (scope->symbolCount > 0) {
+		Symbol** symbols = ARENA_NEW_ARRAY(&compileArena, Symbol*, scope->symbolCount);
+		int      count   = 0;
+		for (int i = 0; i < scope->capacity; i++)
+			if (scope->symbols[i].symbol) symbols[count++] = scope->symbols[i].symbol;
+		qsort(symbols, count, sizeof(Symbol*), comparePrintOrder);
+
+		for (int i = 0; i < count; i++) {
+			if (symbols[i]->kind != SYMBOL_FUNCTION || level == 0) {
+				printSymbol(symbols[i], scope->name);
 			}
 		}
 	}
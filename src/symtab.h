@@ -17,30 +17,77 @@ typedef struct Symbol {
 		int  refCount;   // Number of references
 	} sourceInfo;
 
-	struct Symbol* next; // For hash table chaining
+	int order; // Insertion order within its scope
 } Symbol;
 
+/* slots of small scopes are kept in the Scope itself */
+#define SCOPE_INLINE_SLOTS 4
+
+typedef struct SymbolSlot {
+	unsigned int hash;   // nameHash of the symbol's name
+	Symbol*      symbol; // NULL for an empty slot
+} SymbolSlot;
+
+/* A Binding makes a symbol visible: while its scope is
+ * open it sits on the binding stack of its name
+ */
+typedef struct Binding {
+	Symbol*         symbol;
+	struct Scope*   scope;
+	struct Binding* below;       // Binding of the same name in an outer scope
+	struct Binding* nextInScope; // Undo log of the scope
+} Binding;
+
 typedef struct Scope {
 	const char*    name;
 	struct Scope*  parent;
 	struct Scope** children; // Child scopes
 	int            childCount;
 	int            level;       // Nesting level
-	Symbol**       symbols;     // Hash table of symbols
+	SymbolSlot*    symbols;     // Open-addressing table of symbols
+	int            capacity;    // Slots in symbols, a power of two
 	int            symbolCount; // Number of symbols in this scope
+	SymbolSlot     inlineSymbols[SCOPE_INLINE_SLOTS];
+	bool           open;     // On the chain of open scopes
+	Binding*       bindings; // Undo log: bindings to pop when the scope closes
 } Scope;
 
-/* Symbol table functions */
+/* Symbol table functions
+ * symbols and scopes live in compileArena and are released with it;
+ * every name passed in must be interned (see intern.h), lookups
+ * compare names by pointer.
+ * Every scope keeps its own symbols, which findSymbolInScope and
+ * printSymbolTable use. findSymbol instead keeps the scopes from the
+ * one it was last asked about up to the root open: each name maps to
+ * a stack of bindings, innermost on top, so a lookup is one probe at
+ * any depth. Asking from another scope first closes and opens scopes
+ * until that one is innermost. releaseScopes must follow each
+ * arenaRelease of compileArena. The binding stacks are per thread,
+ * and objects come from threadArena
+ */
 Symbol* createSymbol(const char* name, SymbolKind kind, TypeInfo* type, int offset);
 void    addSymbol(Scope* scope, Symbol* symbol);
 Symbol* findSymbol(Scope* scope, const char* name);
 Symbol* findSymbolInScope(Scope* scope, const char* name);
 void    addReference(Symbol* symbol, int lineNo);
-void    destroySymbol(Symbol* symbol);
 
 /* Scope functions */
 Scope* createScope(const char* name, Scope* parent);
-void   destroyScope(Scope* scope);
+void   releaseScopes(void);
+
+/* closeScopes closes every scope this thread has open,
+ * so none is left marked open with its bindings on this
+ * thread's stacks
+ */
+void closeScopes(void);
+
+/* shareScope lets this thread read the root scope
+ * scope without opening it: findSymbol looks there last,
+ * by probing its table, for scopes nested in it. A scope
+ * that no thread changes can so be shared by threads.
+ * NULL shares none
+ */
+void shareScope(Scope* scope);
 
 /* Symbol table printing functions */
 void printSymbolTable(Scope* globalScope, bool declaredMain);
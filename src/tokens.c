@@ -0,0 +1,291 @@
+#include "tokens.h"
+#include "intern.h"
+#include "util.h"
+
+#include <log.h>
+#include <parser.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* C- averages a token every three or four bytes; the first guess
+ * only has to be close, the arrays double from there */
+#define BYTES_PER_TOKEN 3
+#define MIN_CAPACITY 64
+/* smaller sources are not worth a thread */
+#define MIN_CHUNK_SIZE (1024 * 1024)
+
+static void* growArray(void* array, const size_t capacity, const size_t size) {
+	void* grown = realloc(array, capacity * size);
+	if (!grown) {
+		fprintf(stderr, "Out of memory: cannot buffer %zu tokens\n", capacity);
+		exit(1);
+	}
+	return grown;
+}
+
+static void reserveTokens(TokenStream* stream, const size_t capacity) {
+	stream->kinds    = growArray(stream->kinds, capacity, sizeof(TokenType));
+	stream->offsets  = growArray(stream->offsets, capacity, sizeof(size_t));
+	stream->lengths  = growArray(stream->lengths, capacity, sizeof(unsigned int));
+	stream->lines    = growArray(stream->lines, capacity, sizeof(int));
+	stream->values   = growArray(stream->values, capacity, sizeof(TokenValue));
+	stream->capacity = capacity;
+}
+
+/* lexText lexes all of source into stream. With
+ * deferNames the names of IDs are left NULL, since
+ * the intern table must not be touched from threads
+ */
+static void lexText(TokenStream* stream, const SourceText* source, const int deferNames) {
+	ScanContext scanner;
+	YYSTYPE     value;
+	TokenType   kind;
+
+	memset(stream, 0, sizeof(*stream));
+	reserveTokens(stream, source->length / BYTES_PER_TOKEN + MIN_CAPACITY);
+
+	initScanner(&scanner, source);
+	scanner.quiet      = TRUE;
+	scanner.deferNames = deferNames;
+	do {
+		kind = getToken(&scanner, &value);
+		if (stream->count == stream->capacity) reserveTokens(stream, stream->capacity * 2);
+
+		const size_t i      = stream->count++;
+		stream->kinds[i]    = kind;
+		stream->offsets[i]  = scanner.tokenSpan.offset;
+		stream->lengths[i]  = scanner.tokenSpan.length;
+		stream->lines[i]    = scanner.lineno;
+		stream->values[i]   = (TokenValue) {0};
+		if (kind == NUM)
+			stream->values[i].val = value.val;
+		else if (kind == ID)
+			stream->values[i].name = value.name;
+	} while (kind != ENDFILE);
+	closeScanner(&scanner);
+}
+
+/* Chunked lexing. The source is cut after newlines
+ * into one chunk per thread. No token spans a newline,
+ * so a scan of the whole text is at a chunk boundary
+ * either between tokens or inside a comment. Every
+ * chunk is lexed speculatively as if it were between
+ * tokens; a chunk whose predecessor turns out to end
+ * inside a comment is lexed again from the end of that
+ * comment. The chunks are then copied into one stream,
+ * with offsets and lines moved by prefix sums of the
+ * chunk sizes and newline counts
+ */
+typedef struct LexChunk {
+	const SourceText* source;
+	size_t            begin;    /* lexing starts here */
+	size_t            end;      /* just after a newline, or the end of the text */
+	TokenStream       tokens;   /* offsets from begin, lines from 1, ending with ENDFILE */
+	size_t            newlines; /* before begin in the chunk, after a carried-over comment */
+	TokenStream*      stream;   /* where the tokens go, from index first on line lineBase + 1 */
+	size_t            first;
+	int               lineBase;
+} LexChunk;
+
+/* the flex scanner wants its buffer NUL-terminated, so
+ * it gets a copy of the range; the hand scanner reads
+ * the range in place */
+static void lexRange(TokenStream* tokens, const SourceText* source, const size_t begin,
+                     const size_t end) {
+	SourceText range = {0};
+	if (HandScanner) {
+		range.text   = source->text + begin;
+		range.length = end - begin;
+		lexText(tokens, &range, TRUE);
+	} else {
+		sourceFromMemory(&range, source->text + begin, end - begin);
+		lexText(tokens, &range, TRUE);
+		closeSource(&range);
+	}
+}
+
+static void* lexChunk(void* argument) {
+	LexChunk* chunk = argument;
+	lexRange(&chunk->tokens, chunk->source, chunk->begin, chunk->end);
+	return NULL;
+}
+
+/* skipComment moves *p past the comment body starting
+ * there, following the rule of cminus.l (the character
+ * after a '*' is consumed), and returns FALSE if the
+ * comment does not close before end
+ */
+static int skipComment(const char* text, size_t* p, const size_t end) {
+	while (*p < end) {
+		if (text[(*p)++] == '*' && *p < end && text[(*p)++] == '/') return TRUE;
+	}
+	return FALSE;
+}
+
+/* endsInComment tells whether the text from p, which
+ * holds no tokens, leaves an unclosed comment at end */
+static int endsInComment(const char* text, size_t p, const size_t end) {
+	while (p < end) {
+		if (text[p] == '/' && p + 1 < end && text[p + 1] == '*') {
+			p += 2;
+			if (!skipComment(text, &p, end)) return TRUE;
+		} else
+			p++;
+	}
+	return FALSE;
+}
+
+static size_t countNewlines(const char* text, const size_t begin, const size_t end) {
+	size_t count = 0;
+	for (const char* p = text + begin; (p = memchr(p, '\n', text + end - p)); p++) count++;
+	return count;
+}
+
+/* placeChunk copies the tokens of a chunk, but not its
+ * ENDFILE, to their place in the merged stream */
+static void* placeChunk(void* argument) {
+	LexChunk*          chunk  = argument;
+	TokenStream*       stream = chunk->stream;
+	const TokenStream* tokens = &chunk->tokens;
+	const size_t       count  = tokens->count - 1;
+	const size_t       first  = chunk->first;
+
+	memcpy(stream->kinds + first, tokens->kinds, count * sizeof(TokenType));
+	memcpy(stream->lengths + first, tokens->lengths, count * sizeof(unsigned int));
+	memcpy(stream->values + first, tokens->values, count * sizeof(TokenValue));
+	for (size_t i = 0; i < count; i++) {
+		stream->offsets[first + i] = tokens->offsets[i] + chunk->begin;
+		stream->lines[first + i]   = tokens->lines[i] + chunk->lineBase;
+	}
+	return NULL;
+}
+
+/* runChunks runs work on every chunk, each on its own
+ * thread; a chunk whose thread cannot start is done
+ * on this one */
+static void runChunks(LexChunk* chunks, const int count, void* (*work)(void*)) {
+	pthread_t* threads = calloc(count, sizeof(pthread_t));
+	int*       started = calloc(count, sizeof(int));
+	for (int k = 0; k < count; k++) {
+		started[k] = threads && started && pthread_create(&threads[k], NULL, work, &chunks[k]) == 0;
+		if (!started[k]) work(&chunks[k]);
+	}
+	for (int k = 0; k < count; k++)
+		if (started[k]) pthread_join(threads[k], NULL);
+	free(threads);
+	free(started);
+}
+
+static void lexChunks(TokenStream* stream, const SourceText* source, const int chunkCount) {
+	const char* text   = source->text;
+	LexChunk*   chunks = calloc(chunkCount, sizeof(LexChunk));
+	if (!chunks) {
+		lexText(stream, source, FALSE);
+		return;
+	}
+
+	size_t begin = 0;
+	for (int k = 0; k < chunkCount; k++) {
+		size_t from = source->length / chunkCount * (k + 1);
+		if (from < begin) from = begin; /* a very long line ran past this cut */
+		const char* cut = k + 1 < chunkCount && from < source->length
+		                      ? memchr(text + from, '\n', source->length - from)
+		                      : NULL;
+		chunks[k].source    = source;
+		chunks[k].begin     = begin;
+		chunks[k].end       = cut ? (size_t) (cut - text) + 1 : source->length;
+		begin               = chunks[k].end;
+	}
+	runChunks(chunks, chunkCount, lexChunk);
+
+	/* repair the boundaries, in order, and lay out the stream */
+	size_t tokenCount = 0;
+	int    lineBase   = 0;
+	int    inComment  = FALSE;
+	for (int k = 0; k < chunkCount; k++) {
+		LexChunk* chunk = &chunks[k];
+		if (inComment) {
+			/* the speculation failed: the chunk opens inside a
+			 * comment, which may even cover all of it */
+			size_t resume   = chunk->begin;
+			inComment       = !skipComment(text, &resume, chunk->end);
+			chunk->newlines = countNewlines(text, chunk->begin, resume);
+			chunk->begin    = resume;
+			releaseTokens(&chunk->tokens);
+			lexRange(&chunk->tokens, source, chunk->begin, chunk->end);
+		}
+		chunk->first    = tokenCount;
+		chunk->lineBase = lineBase + chunk->newlines;
+
+		const TokenStream* tokens = &chunk->tokens;
+		const size_t       last   = tokens->count - 1; /* the ENDFILE */
+		const size_t       tail   = last ? tokens->offsets[last - 1] + tokens->lengths[last - 1] : 0;
+		tokenCount += last;
+		lineBase += chunk->newlines + tokens->lines[last] - 1;
+		if (!inComment) inComment = endsInComment(text, chunk->begin + tail, chunk->end);
+	}
+
+	memset(stream, 0, sizeof(*stream));
+	reserveTokens(stream, tokenCount + 1);
+	for (int k = 0; k < chunkCount; k++) chunks[k].stream = stream;
+	runChunks(chunks, chunkCount, placeChunk);
+
+	stream->count                = tokenCount + 1;
+	stream->kinds[tokenCount]    = ENDFILE;
+	stream->offsets[tokenCount]  = source->length;
+	stream->lengths[tokenCount]  = 0;
+	stream->lines[tokenCount]    = lineBase + 1;
+	stream->values[tokenCount]   = (TokenValue) {0};
+
+	/* the intern table is not shared between threads */
+	for (size_t i = 0; i < tokenCount; i++)
+		if (stream->kinds[i] == ID)
+			stream->values[i].name = internString(text + stream->offsets[i], stream->lengths[i]);
+
+	for (int k = 0; k < chunkCount; k++) releaseTokens(&chunks[k].tokens);
+	free(chunks);
+}
+
+void lexSource(TokenStream* stream, const SourceText* source) {
+	size_t chunkCount = LexThreads > 1 ? source->length / MIN_CHUNK_SIZE : 1;
+	if (chunkCount > (size_t) LexThreads) chunkCount = LexThreads;
+
+	if (chunkCount > 1)
+		lexChunks(stream, source, chunkCount);
+	else
+		lexText(stream, source, FALSE);
+}
+
+TokenType replayToken(TokenStream* stream, ScanContext* context, union YYSTYPE* value) {
+	/* a parser that asks past the end keeps getting ENDFILE */
+	const size_t i = stream->next < stream->count ? stream->next++ : stream->count - 1;
+
+	while (context->lineno < stream->lines[i]) {
+		context->lineno++;
+		printLine(context);
+	}
+	context->token            = stream->kinds[i];
+	context->tokenSpan.offset = stream->offsets[i];
+	context->tokenSpan.length = stream->lengths[i];
+	if (context->token == NUM)
+		value->val = stream->values[i].val;
+	else if (context->token == ID)
+		value->name = stream->values[i].name;
+
+	if (TraceScan) {
+		pc("\t%d: ", context->lineno);
+		printToken(context->token, spanText(context->source, context->tokenSpan),
+		           context->tokenSpan.length);
+	}
+	return context->token;
+}
+
+void releaseTokens(TokenStream* stream) {
+	free(stream->kinds);
+	free(stream->offsets);
+	free(stream->lengths);
+	free(stream->lines);
+	free(stream->values);
+	memset(stream, 0, sizeof(*stream));
+}
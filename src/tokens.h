@@ -0,0 +1,47 @@
+#ifndef _TOKENS_H_
+#define _TOKENS_H_
+
+#include "scan.h"
+
+/* the semantic value a scanner gives a token: the
+ * number of a NUM or the interned name of an ID */
+typedef union TokenValue {
+	int         val;
+	const char* name;
+} TokenValue;
+
+/* A TokenStream is the whole token sequence of a
+ * source text, lexed in one pass and kept as parallel
+ * arrays, one per attribute, so each pass over the
+ * tokens touches only the attributes it needs. The
+ * last token is always ENDFILE
+ */
+typedef struct TokenStream {
+	TokenType*    kinds;
+	size_t*       offsets; /* lexeme spans into the source text */
+	unsigned int* lengths;
+	int*          lines;
+	TokenValue*   values;
+	size_t        count;
+	size_t        capacity;
+	size_t        next; /* index of the next token replayed to the parser */
+} TokenStream;
+
+/* Procedure lexSource scans all of source with the
+ * selected scanner into stream. Nothing is echoed or
+ * traced here; replayToken does it as the parser
+ * consumes the tokens
+ */
+void lexSource(TokenStream* stream, const SourceText* source);
+
+/* Function replayToken hands the next token of stream
+ * to the parser as getToken would have: it advances
+ * context to the token's line, echoing the lines on
+ * the way, and traces the token
+ */
+TokenType replayToken(TokenStream* stream, ScanContext* context, union YYSTYPE* value);
+
+/* Procedure releaseTokens frees the arrays of stream */
+void releaseTokens(TokenStream* stream);
+
+#endif
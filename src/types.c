@@ -3,63 +3,108 @@
 //
 
 #include "types.h"
+#include "arena.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define TYPE_BUCKETS 256 // power of two
+
+typedef struct InternedType {
+	struct InternedType* next; // chain of the type table bucket
+	unsigned int         hash;
+	TypeInfo             type;
+} InternedType;
+
+// The plain types are static; every other type is looked up in the type table
+static TypeInfo primitiveTypes[] = {
+    [TYPE_VOID]    = {TYPE_VOID, -1, NULL, {NULL, 0}},
+    [TYPE_INT]     = {TYPE_INT, -1, NULL, {NULL, 0}},
+    [TYPE_BOOLEAN] = {TYPE_BOOLEAN, -1, NULL, {NULL, 0}},
+    [TYPE_ARRAY]   = {TYPE_ARRAY, -1, NULL, {NULL, 0}},
+};
+
+static Arena         typeArena;
+static InternedType* typeBuckets[TYPE_BUCKETS];
+
+// Component types are interned too, so they are hashed and compared by address
+static unsigned int hashType(const Type baseType, const int arraySize, const TypeInfo* returnType,
+                             TypeInfo* const* parameters, const int parameterCount) {
+	uintptr_t h = (uintptr_t) baseType * 31 + (unsigned int) arraySize;
+	h           = h * 31 + (uintptr_t) returnType;
+	for (int i = 0; i < parameterCount; i++) h = h * 31 + (uintptr_t) parameters[i];
+	return (unsigned int) (h ^ (h >> 17));
+}
 
-TypeInfo* createType(const Type baseType) {
-	TypeInfo* type = (TypeInfo*) malloc(sizeof(TypeInfo));
-
-	if (!type) {
-		fprintf(stderr, "Error allocating memory for type info\n");
-		return NULL;
+TypeInfo* internType(const Type baseType, const int arraySize, TypeInfo* returnType,
+                     TypeInfo** parameters, const int parameterCount) {
+	if (arraySize == -1 && !returnType && parameterCount == 0) return &primitiveTypes[baseType];
+
+	const unsigned int hash   = hashType(baseType, arraySize, returnType, parameters, parameterCount);
+	InternedType**     bucket = &typeBuckets[hash & (TYPE_BUCKETS - 1)];
+	for (InternedType* entry = *bucket; entry; entry = entry->next) {
+		const TypeInfo* type = &entry->type;
+		if (entry->hash == hash && type->baseType == baseType && type->arraySize == arraySize &&
+		    type->returnType == returnType && type->parameters.count == parameterCount &&
+		    (parameterCount == 0 ||
+		     memcmp(type->parameters.types, parameters, parameterCount * sizeof(TypeInfo*)) == 0))
+			return &entry->type;
 	}
 
-	type->baseType         = baseType;
-	type->arraySize        = -1;
-	type->returnType       = NULL;
-	type->parameters.types = NULL;
-	type->parameters.count = 0;
+	InternedType* entry    = ARENA_NEW(&typeArena, InternedType);
+	entry->hash            = hash;
+	entry->type.baseType   = baseType;
+	entry->type.arraySize  = arraySize;
+	entry->type.returnType = returnType;
+	if (parameterCount > 0) {
+		entry->type.parameters.types = ARENA_NEW_ARRAY(&typeArena, TypeInfo*, parameterCount);
+		memcpy(entry->type.parameters.types, parameters, parameterCount * sizeof(TypeInfo*));
+	}
+	entry->type.parameters.count = parameterCount;
+	entry->next                  = *bucket;
+	*bucket                      = entry;
+	return &entry->type;
+}
 
-	return type;
+TypeInfo* createType(const Type baseType) {
+	return &primitiveTypes[baseType];
 }
 
 TypeInfo* createArrayType(const Type baseType, const int size) {
-	TypeInfo* type = createType(baseType);
-	if (type) {
-		type->arraySize = size;
-	}
-	return type;
+	return internType(baseType, size, NULL, NULL, 0);
 }
 
 TypeInfo* createFunctionType(TypeInfo* returnType) {
-	TypeInfo* type = createType(TYPE_VOID); // Default to void
-	if (type) {
-		type->returnType = returnType;
-	}
-	return type;
+	return internType(TYPE_VOID, -1, returnType, NULL, 0); // Default to void
 }
 
-void addParameter(TypeInfo* functionType, TypeInfo* parameterType) {
+TypeInfo* addParameter(const TypeInfo* functionType, TypeInfo* parameterType) {
 	if (!functionType || !parameterType) {
 		fprintf(stderr, "Error adding parameters\n");
-		return;
+		return (TypeInfo*) functionType;
 	}
 
-	TypeInfo** newTypes = realloc(functionType->parameters.types,
-	                              sizeof(TypeInfo*) * (functionType->parameters.count + 1));
-	if (!newTypes) {
-		fprintf(stderr, "Error allocating memory for parameters\n");
-		return;
+	const int  count = functionType->parameters.count;
+	TypeInfo** types = malloc((count + 1) * sizeof(TypeInfo*));
+	if (!types) {
+		fprintf(stderr, "Error adding parameters\n");
+		return (TypeInfo*) functionType;
 	}
+	if (count > 0) memcpy(types, functionType->parameters.types, count * sizeof(TypeInfo*));
+	types[count] = parameterType;
 
-	functionType->parameters.types                                 = newTypes;
-	functionType->parameters.types[functionType->parameters.count] = parameterType;
-	functionType->parameters.count++;
+	TypeInfo* extended = internType(functionType->baseType, functionType->arraySize,
+	                                functionType->returnType, types, count + 1);
+	free(types);
+	return extended;
 }
 
 bool areTypesCompatible(const TypeInfo* t1, const TypeInfo* t2) {
 	if (!t1 || !t2) return false;
 
+	if (t1 == t2) return true;
+
 	if (t1->baseType != t2->baseType) return false;
 
 	if (t1->baseType == TYPE_ARRAY && t1->arraySize != t2->arraySize) return false;
@@ -76,19 +121,3 @@ bool areTypesCompatible(const TypeInfo* t1, const TypeInfo* t2) {
 
 	return true;
 }
-
-void destroyType(TypeInfo* type) {
-	if (!type) return;
-
-	if (type->returnType) destroyType(type->returnType);
-
-	for (int i = 0; i < type->parameters.count; i++) {
-		destroyType(type->parameters.types[i]);
-	}
-
-	if (type->parameters.types) {
-		free(type->parameters.types);
-	}
-
-	free(type);
-}
\ No newline at end of file
@@ -8,6 +8,8 @@
 
 typedef enum { TYPE_VOID, TYPE_INT, TYPE_BOOLEAN, TYPE_ARRAY } Type;
 
+// Types are hash-consed: every distinct type exists once, so they are shared and must never be
+// modified. They outlive single compilations.
 typedef struct TypeInfo {
 	Type             baseType;
 	int              arraySize;  // -1 for non-arrays
@@ -18,11 +20,12 @@ typedef struct TypeInfo {
 	} parameters;
 } TypeInfo;
 
+TypeInfo* internType(Type baseType, int arraySize, TypeInfo* returnType, TypeInfo** parameters,
+                     int parameterCount);
 TypeInfo* createType(Type baseType);
 TypeInfo* createArrayType(Type baseType, int size);
 TypeInfo* createFunctionType(TypeInfo* returnType);
 bool      areTypesCompatible(const TypeInfo* t1, const TypeInfo* t2);
-void      addParameter(TypeInfo* functionType, TypeInfo* paramType);
-void      destroyType(TypeInfo* type);
+TypeInfo* addParameter(const TypeInfo* functionType, TypeInfo* paramType);
 
 #endif // TYPES_H
@@ -1,15 +1,19 @@
 #include "util.h"
+#include "arena.h"
 #include "globals.h"
+#include "visit.h"
 
+#include <errno.h>
 #include <log.h>
 #include <parser.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
 /* Procedure printToken prints a token
  * and its lexeme to the listing file
  */
-void printToken(const TokenType token, const char* tokenString) {
+void printToken(const TokenType token, const char* lexeme, const size_t length) {
 	switch (token) {
 		case IF:
 		case ELSE:
@@ -17,7 +21,7 @@ void printToken(const TokenType token, const char* tokenString) {
 		case RETURN:
 		case VOID:
 		case WHILE:
-			pc("reserved word: %s\n", tokenString);
+			pc("reserved word: %.*s\n", (int) length, lexeme);
 			break;
 		case ASSIGN:
 			pc("=\n");
@@ -80,13 +84,13 @@ void printToken(const TokenType token, const char* tokenString) {
 			pc("EOF\n");
 			break;
 		case NUM:
-			pc("NUM, val= %s\n", tokenString);
+			pc("NUM, val= %.*s\n", (int) length, lexeme);
 			break;
 		case ID:
-			pc("ID, name= %s\n", tokenString);
+			pc("ID, name= %.*s\n", (int) length, lexeme);
 			break;
 		case ERROR:
-			pce("ERROR: %s\n", tokenString);
+			pce("ERROR: %.*s\n", (int) length, lexeme);
 			break;
 		default:
 			pce("Unknown token: %d\n", token);
@@ -96,38 +100,39 @@ void printToken(const TokenType token, const char* tokenString) {
 /* Function newStmtNode creates a new statement
  * node for syntax tree construction
  */
-ASTNode* newStmtNode(const int kind) {
-	ASTNode* node = createNode(kind);
-	if (!node) {
-		fprintf(stderr, "Out of memory error at line %d\n", lineno);
-		return NULL;
-	}
-	node->lineNo = lineno;
-	return node;
+ASTNode* newStmtNode(const int kind, const int lineNo) {
+	return astNode(createNode(kind, lineNo));
 }
 
-ASTNode* newExpNode(const int kind) {
-	ASTNode* node = createNode(kind);
-	if (!node) {
-		fprintf(stderr, "Out of memory error at line %d\n", lineno);
-		return NULL;
-	}
-	node->lineNo = lineno;
-	return node;
+ASTNode* newExpNode(const int kind, const int lineNo) {
+	return astNode(createNode(kind, lineNo));
 }
 
 /* Function copyString allocates and makes a new
- * copy of an existing string
+ * copy of an existing string in compileArena
  */
 char* copyString(const char* s) {
-	if (s == NULL) return NULL;
-	const unsigned int n = strlen(s) + 1;
-	char*              t = malloc(n);
-	if (t == NULL)
-		pce("Out of memory error at line %d\n", lineno);
-	else
-		strcpy(t, s);
-	return t;
+	return arenaStrdup(&compileArena, s);
+}
+
+char* formatString(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	const int length = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+
+	char* str = arenaAlloc(threadArena, length + 1);
+	va_start(args, format);
+	vsnprintf(str, length + 1, format, args);
+	va_end(args);
+	return str;
+}
+
+int parseNumber(const char* text, const long minimum, const long maximum, long* number) {
+	char* end;
+	errno   = 0;
+	*number = strtol(text, &end, 10);
+	return end != text && *end == '\0' && errno == 0 && *number >= minimum && *number <= maximum;
 }
 
 /* Variable indentno is used by printTree to
@@ -145,33 +150,19 @@ static void printSpaces(void) {
 }
 
 /* Procedure printLine prints a full line
- * of the source code, with its number
- * reduntand_source is ANOTHER instance
- * of file pointer opened with the source code.
+ * of the source code, with its number.
+ * Lines come from the line index of the source,
+ * so they may be of any length
  */
-void printLine() {
-	static int currentLine = 0;
-	static int firstCall   = 1;
-	char       line[1024];
-
-	if (firstCall) {
-		rewind(redundant_source); // Restart reading from the beginning
-		firstCall = 0;
-	}
+void printLine(ScanContext* context) {
+	if (!EchoSource || context->quiet || context->echoedLines >= context->source->lineCount) return;
 
-	const char* ret = fgets(line, sizeof(line), redundant_source);
-	if (ret) {
-		currentLine++;
-		pc("%d: %s", currentLine, line);
+	size_t      length;
+	const char* line = sourceLine(context->source, context->echoedLines++, &length);
+	pc("%zu: %.*s", context->echoedLines, (int) length, line);
 
-		// Handle EOF condition
-		if (feof(redundant_source)) {
-			// If the line doesn't end with a newline, add one
-			if (line[strlen(line) - 1] != '\n') {
-				pc("\n");
-			}
-		}
-	}
+	// If the last line doesn't end with a newline, add one
+	if (line[length - 1] != '\n') pc("\n");
 }
 
 const char* ExpTypeToString(const TypeInfo* type) {
@@ -189,95 +180,119 @@ const char* ExpTypeToString(const TypeInfo* type) {
 	}
 }
 
-/* procedure printTree prints a syntax tree to the
- * listing file using indentation to indicate subtrees
+/* printNode prints the line of a single node */
+static void printNode(const ASTNode* tree) {
+	printSpaces();
+	switch (tree->kind) {
+		case NODE_PROGRAM:
+			pc("Program\n");
+			break;
+		case NODE_FUNCTION:
+			pc("Declare function (return type \"%s\"): %s\n",
+			   ExpTypeToString(tree->data.symbol.type->returnType), tree->data.symbol.name);
+			break;
+		case NODE_IF:
+			pc("Conditional selection\n");
+			break;
+		case NODE_WHILE:
+			pc("Iteration (loop)\n");
+			break;
+		case NODE_ASSIGN: {
+			const ASTNode* target = astChild(tree, 0);
+
+			if (target == NULL) {
+				pc("Assign to: (unknown)\n");
+			} else if (target->kind == NODE_IDENTIFIER) {
+				if (astChild(target, 0) != NULL)
+					pc("Assign to array: %s\n", target->data.symbol.name);
+				else
+					pc("Assign to var: %s\n", target->data.symbol.name);
+			}
+			break;
+		}
+		case NODE_PARAM:
+			pc("Function param (%s %s): %s\n", ExpTypeToString(tree->data.symbol.type),
+			   (tree->data.symbol.type->arraySize >= 0 ? "array" : "var"), tree->data.symbol.name);
+			break;
+		case NODE_VARIABLE:
+			pc("Declare %s %s: %s\n", ExpTypeToString(tree->data.symbol.type),
+			   (tree->data.symbol.type->arraySize >= 0 ? "array" : "var"), tree->data.symbol.name);
+			break;
+		case NODE_OPERATOR:
+			pc("Op: ");
+			printToken(tree->data.operator, "", 0);
+			break;
+		case NODE_CONSTANT:
+			pc("Const: %d\n", tree->data.constValue);
+			break;
+		case NODE_IDENTIFIER:
+			pc("Id: %s\n", tree->data.symbol.name);
+			break;
+		case NODE_CALL:
+			pc("Function call: %s\n", tree->data.symbol.name);
+			break;
+		case NODE_RETURN:
+			pc("Return\n");
+			break;
+		case NODE_BLOCK:
+			break;
+		default:
+			pce("Unknown ExpNode kind\n");
+			break;
+	}
+}
+
+/* printedChild returns the i-th subtree shown under
+ * tree. An assignment to a name shows the array index,
+ * if any, and the value, not the target identifier
+ * again; other assignments show nothing
  */
-void printTree(const ASTNode* tree) {
-	while (tree != NULL) {
-		printSpaces();
+static ASTNode* printedChild(const ASTNode* tree, const int i) {
+	if (tree->kind != NODE_ASSIGN) return astChild(tree, i);
 
-		if (tree->kind) {
-			switch (tree->kind) {
-				case NODE_PROGRAM:
-					pc("Program\n");
-					break;
-				case NODE_FUNCTION:
-					pc("Declare function (return type \"%s\"): %s\n",
-					   ExpTypeToString(tree->data.symbol.type->returnType), tree->data.symbol.name);
-					break;
-				case NODE_IF:
-					pc("Conditional selection\n");
-					break;
-				case NODE_WHILE:
-					pc("Iteration (loop)\n");
-					break;
-				case NODE_ASSIGN: {
-					ASTNode* target = tree->children[0];
+	const ASTNode* target = astChild(tree, 0);
+	if (target == NULL || target->kind != NODE_IDENTIFIER) return NULL;
+	switch (i) {
+		case 0:
+			return astChild(target, 0);
+		case 1:
+			return astChild(tree, 1);
+		default:
+			return NULL;
+	}
+}
 
-					if (target == NULL) {
-						pc("Assign to: (unknown)\n");
-						break;
-					}
+/* printStep prints a node, then each of its subtrees
+ * one indentation level deeper, then moves on to the
+ * next sibling in the same frame
+ */
+static bool printStep(VisitStack* stack, VisitFrame* frame, void* context) {
+	const ASTNode* tree = frame->node;
+	(void) context;
 
-					if (target->kind == NODE_IDENTIFIER) {
-						if (target->children[0] != NULL) {
-							pc("Assign to array: %s\n", target->data.symbol.name);
-							INDENT;
-							printTree(target->children[0]); // Print array index
-							UNINDENT;
-						} else {
-							pc("Assign to var: %s\n", target->data.symbol.name);
-						}
-						// Only print the value being assigned, not the target identifier again
-						INDENT;
-						printTree(tree->children[1]); // Print the value being assigned
-						UNINDENT;
-						tree = tree->next;
-						continue;
-					}
-					break;
-				}
-				case NODE_PARAM:
-					pc("Function param (%s %s): %s\n", ExpTypeToString(tree->data.symbol.type),
-					   (tree->data.symbol.type->arraySize >= 0 ? "array" : "var"),
-					   tree->data.symbol.name);
-					break;
-				case NODE_VARIABLE:
-					pc("Declare %s %s: %s\n", ExpTypeToString(tree->data.symbol.type),
-					   (tree->data.symbol.type->arraySize >= 0 ? "array" : "var"),
-					   tree->data.symbol.name);
-					break;
-				case NODE_OPERATOR:
-					pc("Op: ");
-					printToken(tree->data.operator, "\0");
-					break;
-				case NODE_CONSTANT:
-					pc("Const: %d\n", tree->data.constValue);
-					break;
-				case NODE_IDENTIFIER:
-					pc("Id: %s\n", tree->data.symbol.name);
-					break;
-				case NODE_CALL:
-					pc("Function call: %s\n", tree->data.symbol.name);
-					break;
-				case NODE_RETURN:
-					pc("Return\n");
-					break;
-				case NODE_BLOCK:
-					break;
-				default:
-					pce("Unknown ExpNode kind\n");
-					break;
-			}
+	if (frame->step == 0)
+		printNode(tree);
+	else
+		UNINDENT;
 
-			if (tree->kind != NODE_ASSIGN) {
-				for (int i = 0; i < MAXCHILDREN; i++) {
-					INDENT;
-					printTree(tree->children[i]);
-					UNINDENT;
-				}
-			}
-			tree = tree->next;
-		}
+	if (frame->step < MAXCHILDREN) {
+		INDENT;
+		visitPush(stack, printedChild(tree, frame->step++));
+		return true;
 	}
+
+	if (tree->next == NO_NODE) return false;
+	frame->node = astNext(tree);
+	frame->step = 0;
+	return true;
+}
+
+/* the stack of printTree, kept for the next tree */
+static VisitStack printStack;
+
+/* procedure printTree prints a syntax tree to the
+ * listing file using indentation to indicate subtrees
+ */
+void printTree(const ASTNode* tree) {
+	visitRun(&printStack, (ASTNode*) tree, printStep, NULL);
 }
\ No newline at end of file
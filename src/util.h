@@ -3,28 +3,43 @@
 
 #include "ast.h"
 #include "globals.h"
+#include "scan.h"
 
 /* Procedure printToken prints a token
  * and its lexeme to the listing file
  */
-void printToken(TokenType token, const char* tokenString);
+void printToken(TokenType token, const char* lexeme, size_t length);
 
 /* Function newStmtNode creates a new statement
  * node for syntax tree construction
  */
-ASTNode* newStmtNode(int kind);
+ASTNode* newStmtNode(int kind, int lineNo);
 
 /* Function newExpNode creates a new expression
  * node for syntax tree construction
  */
-ASTNode* newExpNode(int kind);
+ASTNode* newExpNode(int kind, int lineNo);
 
 /* Function copyString allocates and makes a new
- * copy of an existing string
+ * copy of an existing string in compileArena
  */
 char* copyString(const char* str);
 
-void printLine();
+/* Function formatString formats like sprintf into a
+ * new string in threadArena, however long it gets
+ */
+char* formatString(const char* format, ...);
+
+/* Function parseNumber reads text, which must be a whole
+ * decimal number from minimum to maximum, into *number.
+ * It returns FALSE for anything else
+ */
+int parseNumber(const char* text, long minimum, long maximum, long* number);
+
+/* Procedure printLine echoes the next source line
+ * of the scan, with its number, to the listing file
+ */
+void printLine(ScanContext* context);
 
 /* procedure printTree prints a syntax tree to the
  * listing file using indentation to indicate subtrees
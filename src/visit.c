@@ -0,0 +1,65 @@
+#include "visit.h"
+#include "globals.h"
+
+#include <stdlib.h>
+
+#define VISIT_INITIAL_FRAMES 64
+
+typedef struct VisitProcs {
+	VisitFn pre;
+	VisitFn post;
+} VisitProcs;
+
+void visitPush(VisitStack* stack, ASTNode* node) {
+	if (!node) return;
+	if (stack->depth == stack->capacity) {
+		const int   capacity = stack->capacity ? 2 * stack->capacity : VISIT_INITIAL_FRAMES;
+		VisitFrame* frames   = realloc(stack->frames, capacity * sizeof(VisitFrame));
+		if (!frames) {
+			fprintf(stderr, "Out of memory: cannot visit %d nested nodes\n", capacity);
+			exit(1);
+		}
+		stack->frames   = frames;
+		stack->capacity = capacity;
+	}
+	stack->frames[stack->depth++] = (VisitFrame) {.node = node};
+}
+
+void visitRun(VisitStack* stack, ASTNode* node, const StepFn step, void* context) {
+	const int base = stack->depth;
+	visitPush(stack, node);
+	while (stack->depth > base) {
+		const int  top   = stack->depth - 1;
+		VisitFrame frame = stack->frames[top];
+		if (step(stack, &frame, context))
+			stack->frames[top] = frame;
+		else
+			stack->depth = top;
+	}
+}
+
+/* prePostStep calls pre, visits the children one step
+ * at a time and calls post; the frame then moves on to
+ * the next sibling, so long lists take a single frame
+ */
+static bool prePostStep(VisitStack* stack, VisitFrame* frame, void* context) {
+	const VisitProcs* procs = context;
+	ASTNode*          t     = frame->node;
+
+	if (frame->step == 0 && procs->pre) procs->pre(t);
+	if (frame->step < MAXCHILDREN) {
+		visitPush(stack, astChild(t, frame->step++));
+		return true;
+	}
+	if (procs->post) procs->post(t);
+
+	if (t->next == NO_NODE) return false;
+	frame->node = astNext(t);
+	frame->step = 0;
+	return true;
+}
+
+void visitTree(VisitStack* stack, ASTNode* t, const VisitFn preProc, const VisitFn postProc) {
+	VisitProcs procs = {preProc, postProc};
+	visitRun(stack, t, prePostStep, &procs);
+}
@@ -0,0 +1,54 @@
+#ifndef _VISIT_H_
+#define _VISIT_H_
+
+#include "ast.h"
+
+#include <stdbool.h>
+
+/* Passes over the syntax tree walk it without recursion:
+ * the nodes being visited are frames of a VisitStack on
+ * the heap, so nesting depth is limited by memory rather
+ * than by the C stack. A pass keeps its stack between
+ * walks and reuses the frames it grew.
+ */
+typedef struct VisitFrame {
+	ASTNode* node;
+	int      step;     /* how far the pass has got with node, 0 on entry */
+	ASTNode* cursor;   /* pass state: a child list being walked */
+	int      saved[2]; /* pass state: values kept between steps */
+} VisitFrame;
+
+typedef struct VisitStack {
+	VisitFrame* frames;
+	int         depth;
+	int         capacity;
+} VisitStack;
+
+/* A StepFn advances the visit of frame->node. It returns
+ * true to be called again for the frame, after the frames
+ * it pushed have been visited, and false when the node
+ * is done, in which case it must not have pushed any.
+ * frame is a copy, since pushing may move the stack
+ */
+typedef bool (*StepFn)(VisitStack* stack, VisitFrame* frame, void* context);
+
+/* A VisitFn is a preorder or postorder callback */
+typedef void (*VisitFn)(ASTNode* t);
+
+/* Procedure visitPush schedules a visit of node before
+ * the current frame resumes; a NULL node is ignored
+ */
+void visitPush(VisitStack* stack, ASTNode* node);
+
+/* Procedure visitRun visits node with step until its
+ * frame and every frame pushed on top of it are done
+ */
+void visitRun(VisitStack* stack, ASTNode* node, StepFn step, void* context);
+
+/* Procedure visitTree walks t, its children and its
+ * siblings calling preProc on each node before its
+ * children and postProc after them. Either may be NULL
+ */
+void visitTree(VisitStack* stack, ASTNode* t, VisitFn preProc, VisitFn postProc);
+
+#endif